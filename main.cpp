@@ -30,12 +30,169 @@
 #include <cstdarg>
 #include <cstring>
 #include <cstdint>
+#include <cstdlib>
 #include <cassert>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
 #include "mpts_parser.h"
+#include "mpts_reader.h"
+#include "mpts_sync.h"
+#include "mpts_parallel.h"
+#include "mpts_records.h"
+#include "mpts_index.h"
+#include "mpts_writer.h"
+#include "mpts_checkpoint.h"
 #include "util.h"
 
+// How often --follow looks whether the input has grown, in milliseconds
+#define FOLLOW_POLL_INTERVAL 250
+
 uint8_t g_test_packet[188] = { 0x47, 0x00, 0x31, 0x35, 0x57, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x46, 0xCD, 0x90, 0xE6, 0xF1, 0x0D, 0x1A, 0xB5, 0xA6, 0x36, 0xFA, 0x5E, 0x17, 0x23, 0x75, 0x8F, 0x6F, 0x8F, 0x34, 0x68, 0xD6, 0xA8, 0xDB, 0xEA, 0x34, 0x3A, 0xB0, 0x39, 0xBE, 0x5E, 0xD1, 0xA3, 0x51, 0xAB, 0x1B, 0x7B, 0xFA, 0x53, 0x55, 0x16, 0xA3, 0x78, 0x56, 0x8D, 0x7A, 0xCA, 0x36, 0xF5, 0x84, 0xC4, 0x6E, 0x92, 0x5D, 0x6F, 0x02, 0xD1, 0xB4, 0xAD, 0x11, 0xB7, 0xD7, 0x61, 0x6D, 0xCA, 0xD0, 0xE8, 0xDF, 0x37, 0x68, 0xD9, 0x6B, 0x54, 0x6D, 0xEA, 0x9A, 0x96, 0xF3, 0x6D, 0x1B, 0x6A, 0xD1, 0x1B, 0x7A, 0x2A, 0xCE, 0xDE, 0x69, 0xA3, 0x55, 0x62, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00 };
 
+// One summary of everything skipped instead of an error per packet
+static void printSyncLoss(const char *programName, int64_t lostBytes, uint64_t resyncCount, const std::vector<syncLoss> &losses)
+{
+    if(0 == lostBytes)
+        return;
+
+    util::printfXml(1, "<sync_loss bytes=\"%lld\" resyncs=\"%llu\">\n", (long long) lostBytes, (unsigned long long) resyncCount);
+
+    for(const auto &loss : losses)
+        util::printfXml(2, "<lost start=\"%lld\" bytes=\"%lld\"/>\n", (long long) loss.fileOffset, (long long) loss.bytes);
+
+    util::printfXml(1, "</sync_loss>\n");
+
+    fprintf(stderr, "%s: Lost sync %llu times, skipped %lld bytes\n", programName, (unsigned long long) resyncCount, (long long) lostBytes);
+}
+
+static void printContinuity(const char *programName, const mptsContinuity &continuity)
+{
+    continuity.print();
+
+    if(continuity.getErrorCount())
+        fprintf(stderr, "%s: %llu continuity or transport errors\n", programName, (unsigned long long) continuity.getErrorCount());
+}
+
+static void printSkippedSections(uint64_t count)
+{
+    if(count)
+        util::printfXml(1, "<skipped_sections count=\"%llu\"/>\n", (unsigned long long) count);
+}
+
+static void printBufferStats(size_t highWaterMark, size_t allocationCount)
+{
+    fprintf(stderr, "Video buffers: largest frame copy %zu bytes, %zu allocations\n", highWaterMark, allocationCount);
+}
+
+// --follow: the input ended for now, wait for more to be added to it.
+// Gives up after idleSeconds without anything new, or never when idleSeconds is 0.
+static size_t waitForInput(mptsReader &reader, uint8_t *&p, double idleSeconds)
+{
+    // Everything parsed so far is out while waiting, the -w thread flushes by itself
+    util::flushXml();
+
+    if(util::getXmlFile() && nullptr == util::getXmlWriter())
+        fflush(util::getXmlFile());
+
+    auto idleStart = std::chrono::steady_clock::now();
+
+    for(;;)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(FOLLOW_POLL_INTERVAL));
+
+        if(false == reader.resume())
+            return 0;
+
+        size_t size = reader.read(p);
+
+        if(size)
+            return size;
+
+        std::chrono::duration<double> idle = std::chrono::steady_clock::now() - idleStart;
+
+        if(idleSeconds > 0. && idle.count() >= idleSeconds)
+            return 0;
+    }
+}
+
+static void printWriterStats(const asyncWriter &writer)
+{
+    fprintf(stderr, "Output writer: %llu buffers, %llu bytes, at most %zu queued, %llu waits for the writer taking %.3f seconds\n",
+        (unsigned long long) writer.getBufferCount(), (unsigned long long) writer.getByteCount(), writer.getHighWaterMark(),
+        (unsigned long long) writer.getStallCount(), writer.getStallSeconds());
+}
+
+// Write out the buffered xml, wait for the -w thread to write it, and close the -o file
+static void closeOutput(FILE *pOutputFile, asyncWriter *pWriter)
+{
+    util::setXmlFile(stdout);
+
+    if(pWriter)
+        pWriter->finish();
+
+    if(pOutputFile)
+        fclose(pOutputFile);
+}
+
+// A comma separated list of PIDs, decimal or 0x prefixed hex. False on anything else or a PID above 0x1FFF
+static bool parsePidList(const char *list, std::vector<uint16_t> &pids)
+{
+    char *end = nullptr;
+
+    pids.clear();
+
+    for(const char *p = list; ; p = end + 1)
+    {
+        unsigned long pid = strtoul(p, &end, 0);
+
+        if(end == p || pid > 0x1FFF || (',' != *end && 0 != *end))
+            return false;
+
+        pids.push_back((uint16_t) pid);
+
+        if(0 == *end)
+            return true;
+    }
+}
+
+// The options that decide what the output looks like, a checkpoint is only resumed with the same ones
+static std::string getCheckpointOptions(int argc, char *argv[])
+{
+    // How to read and write makes no difference to the output, nor does -p.
+    // -j and -b do, they decide the chunks and with several video PIDs the order of the frames.
+    static const char *ignored[] = { "-a", "-m", "-p", "-w" };
+    static const char *ignoredWithValue[] = { "-d", "--checkpoint-interval" };
+    std::string options;
+
+    for(int i = 1; i < argc - 1; i++)
+    {
+        bool bIgnored = false;
+
+        for(const char *pName : ignored)
+            bIgnored |= (0 == strcmp(pName, argv[i]));
+
+        for(const char *pName : ignoredWithValue)
+        {
+            if(0 == strcmp(pName, argv[i]))
+            {
+                bIgnored = true;
+                i++;
+            }
+        }
+
+        if(false == bIgnored)
+        {
+            options += argv[i];
+            options += ' ';
+        }
+    }
+
+    return options;
+}
+
 // It all starts here
 int main(int argc, char* argv[])
 {
@@ -45,16 +202,78 @@ int main(int argc, char* argv[])
     bool bProgress = false;
     bool bTerse = true;
     bool bAnalyzeElementaryStream = false;
-    size_t filePosition = 0;
+    bool bMemoryMap = false;
+    bool bAsyncRead = false;
+    bool bAsyncWrite = false;
+    bool bFollow = false;
+    double followSeconds = 0.;
+    const char *checkpointName = nullptr;
+    double checkpointSeconds = CHECKPOINT_INTERVAL;
+    bool bResume = false;
+    bool bContinuity = false;
+    bool bPcr = false;
+    bool bStats = false;
+    bool bAllTables = false;
+    bool bTableRepeats = false;
+    bool bIndexSummary = false;
+    int64_t frameQuery = -1;
+    int64_t ptsQuery = -1;
+    int64_t startFrame = -1;
+    int64_t endFrame = -1;
+    size_t blockPackets = 10000;
+    size_t queueDepth = 4;
+    unsigned int jobs = 1;
+    int64_t rangeStart = -1;
+    int64_t rangeEnd = -1;
+    double startSeconds = -1.;
+    double endSeconds = -1.;
+    std::vector<uint16_t> pidFilter;
+    const char *outputName = nullptr;
+    const char *format = "xml";
+    std::unique_ptr<mptsRecordWriter> pRecords;
+    std::unique_ptr<asyncWriter> pWriter;
+    FILE *pOutputFile = nullptr;
+    int64_t filePosition = 0;
 
     if (1 == argc)
     {
         fprintf(stderr, "%s: Output extensive xml representation of MPTS file to stdout\n", argv[0]);
-        fprintf(stderr, "Usage: %s [-e] [-p] [-q] [-v] mpts_file\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-a] [-b packets] [-c] [-d depth] [-e] [-j jobs] [-m] [-o file] [-p] [-q] [-v] [-w]\n"
+                        "       [--start byte] [--end byte] [--start-time seconds] [--end-time seconds] [--pids pid,...] [--pcr] [--stats]\n"
+                        "       [--all-tables] [--table-repeats] [--format xml|binary|jsonl]\n"
+                        "       [--index] [--frame number] [--frame-at-pts pts] [--start-frame number] [--end-frame number]\n"
+                        "       [--follow seconds] [--checkpoint file] [--checkpoint-interval seconds] mpts_file\n", argv[0]);
+        fprintf(stderr, "mpts_file: Use - to read from stdin or a pipe\n");
+        fprintf(stderr, "-a: Read the input on a separate thread, overlapping reads with parsing\n");
+        fprintf(stderr, "-b: Number of packets per read block, default 10000\n");
+        fprintf(stderr, "-c: Check the continuity counters and count transport error and scrambled packets\n");
+        fprintf(stderr, "-d: Number of read blocks queued ahead by -a, default 4\n");
         fprintf(stderr, "-e: Also analyze the video elementary stream in the MPTS\n");
+        fprintf(stderr, "-j: Split the file into chunks and parse them on this many threads, default 1\n");
+        fprintf(stderr, "-m: Memory map the input file instead of reading it in blocks\n");
+        fprintf(stderr, "-o: Write the xml to this file instead of stdout\n");
         fprintf(stderr, "-p: Print progress on a single line to stderr\n");
         fprintf(stderr, "-q: No output. Run through the file and only print errors\n");
         fprintf(stderr, "-v: Verbose output. Careful with this one\n");
+        fprintf(stderr, "-w: Write the output on a separate thread, so a slow reader of it doesn't slow the parse. -p also prints how often it had to wait\n");
+        fprintf(stderr, "--start, --end: Only parse the frames sent between these byte positions\n");
+        fprintf(stderr, "--start-time, --end-time: Only parse the frames sent between these times, in seconds from the first time stamp\n");
+        fprintf(stderr, "--pcr: Report the PCR intervals and jitter, and the transport bitrate over time\n");
+        fprintf(stderr, "--stats: Only count the packets, frames and frame types of each PID and print a summary\n");
+        fprintf(stderr, "--pids: Only parse packets of these PIDs, like 0x100,0x101. The PAT and PMT are always parsed\n");
+        fprintf(stderr, "--all-tables: Print every PAT and PMT, not only the first one and the ones that change\n");
+        fprintf(stderr, "--table-repeats: Print how many versions and unchanged repeats of each PAT and PMT there were\n");
+        fprintf(stderr, "--index: Print a summary of the frame index kept in mpts_file.idx. The index is built when it is missing or out of date\n");
+        fprintf(stderr, "--frame, --frame-at-pts: Look up a frame, by number or by the PTS it is shown at, in the index.\n"
+                        "                         --frame-at-pts looks at the first PID of --pids, or else the first video PID\n");
+        fprintf(stderr, "--start-frame, --end-frame: Only parse from one frame to another, found through the index. Frames keep\n"
+                        "                            their numbers from the index, packets are numbered from 0 at the start frame\n");
+        fprintf(stderr, "--follow: Keep parsing what is added to a file that is still being recorded, until nothing is added\n"
+                        "          for this many seconds, 0 to never stop. Parses on a single thread with buffered reads\n");
+        fprintf(stderr, "--checkpoint: Save how far the parse got to this file every so often, needs -o. When the file is there\n"
+                        "              the parse goes on from it, run with the same options and output. It is removed once done\n");
+        fprintf(stderr, "--checkpoint-interval: Seconds between checkpoints, default %.0f\n", CHECKPOINT_INTERVAL);
+        fprintf(stderr, "--format: xml, the default, binary for fixed size records or jsonl for one JSON object per line, see mpts_records.h\n");
         return 0;
     }
 
@@ -62,22 +281,138 @@ int main(int argc, char* argv[])
     {
         if (0 == strcmp("-p", argv[i]))
             bProgress = true;
-
-        if(0 == strcmp("-q", argv[i]))
+        else if(0 == strcmp("-q", argv[i]))
             xmlOut = false;
-
-        if(0 == strcmp("-v", argv[i]))
+        else if(0 == strcmp("-v", argv[i]))
             bTerse = false;
-
-        if(0 == strcmp("-e", argv[i]))
+        else if(0 == strcmp("-e", argv[i]))
             bAnalyzeElementaryStream = true;
+        else if(0 == strcmp("-m", argv[i]))
+            bMemoryMap = true;
+        else if(0 == strcmp("-a", argv[i]))
+            bAsyncRead = true;
+        else if(0 == strcmp("-w", argv[i]))
+            bAsyncWrite = true;
+        else if(0 == strcmp("-c", argv[i]))
+            bContinuity = true;
+        else if(0 == strcmp("-b", argv[i]) && i + 1 < argc - 1)
+            blockPackets = strtoul(argv[++i], nullptr, 0);
+        else if(0 == strcmp("-d", argv[i]) && i + 1 < argc - 1)
+            queueDepth = strtoul(argv[++i], nullptr, 0);
+        else if(0 == strcmp("-o", argv[i]) && i + 1 < argc - 1)
+            outputName = argv[++i];
+        else if(0 == strcmp("-j", argv[i]) && i + 1 < argc - 1)
+            jobs = strtoul(argv[++i], nullptr, 0);
+        else if(0 == strcmp("--start", argv[i]) && i + 1 < argc - 1)
+            rangeStart = strtoll(argv[++i], nullptr, 0);
+        else if(0 == strcmp("--end", argv[i]) && i + 1 < argc - 1)
+            rangeEnd = strtoll(argv[++i], nullptr, 0);
+        else if(0 == strcmp("--start-time", argv[i]) && i + 1 < argc - 1)
+            startSeconds = strtod(argv[++i], nullptr);
+        else if(0 == strcmp("--end-time", argv[i]) && i + 1 < argc - 1)
+            endSeconds = strtod(argv[++i], nullptr);
+        else if(0 == strcmp("--pcr", argv[i]))
+            bPcr = true;
+        else if(0 == strcmp("--stats", argv[i]))
+            bStats = true;
+        else if(0 == strcmp("--all-tables", argv[i]))
+            bAllTables = true;
+        else if(0 == strcmp("--table-repeats", argv[i]))
+            bTableRepeats = true;
+        else if(0 == strcmp("--pids", argv[i]) && i + 1 < argc - 1)
+        {
+            if(false == parsePidList(argv[++i], pidFilter))
+            {
+                fprintf(stderr, "%s: Bad PID list %s, expected PIDs up to 0x1FFF like 0x100,0x101\n", argv[0], argv[i]);
+                return -1;
+            }
+        }
+        else if(0 == strcmp("--format", argv[i]) && i + 1 < argc - 1)
+            format = argv[++i];
+        else if(0 == strcmp("--follow", argv[i]) && i + 1 < argc - 1)
+        {
+            bFollow = true;
+            followSeconds = strtod(argv[++i], nullptr);
+        }
+        else if(0 == strcmp("--checkpoint", argv[i]) && i + 1 < argc - 1)
+            checkpointName = argv[++i];
+        else if(0 == strcmp("--checkpoint-interval", argv[i]) && i + 1 < argc - 1)
+            checkpointSeconds = strtod(argv[++i], nullptr);
+        else if(0 == strcmp("--index", argv[i]))
+            bIndexSummary = true;
+        else if(0 == strcmp("--frame", argv[i]) && i + 1 < argc - 1)
+            frameQuery = strtoll(argv[++i], nullptr, 0);
+        else if(0 == strcmp("--frame-at-pts", argv[i]) && i + 1 < argc - 1)
+            ptsQuery = strtoll(argv[++i], nullptr, 0);
+        else if(0 == strcmp("--start-frame", argv[i]) && i + 1 < argc - 1)
+            startFrame = strtoll(argv[++i], nullptr, 0);
+        else if(0 == strcmp("--end-frame", argv[i]) && i + 1 < argc - 1)
+            endFrame = strtoll(argv[++i], nullptr, 0);
     }
 
+    // The records take the place of the xml, -q still turns all output off
+    if(0 == strcmp("binary", format) || 0 == strcmp("jsonl", format))
+    {
+        if(xmlOut && 'b' == format[0])
+            pRecords.reset(new mptsBinaryWriter);
+        else if(xmlOut)
+            pRecords.reset(new mptsJsonWriter);
+
+        xmlOut = false;
+    }
+    else if(strcmp("xml", format))
+    {
+        fprintf(stderr, "%s: Unknown output format %s\n", argv[0], format);
+        return -1;
+    }
+
+    // Only fread can pick up what is added to the file after it reached the end
+    if(bFollow && (bMemoryMap || bAsyncRead))
+    {
+        fprintf(stderr, "%s: --follow reads the file with buffered reads, ignoring -m and -a\n", argv[0]);
+        bMemoryMap = false;
+        bAsyncRead = false;
+    }
+
+    if(checkpointName && (bFollow || bIndexSummary || frameQuery >= 0 || ptsQuery >= 0))
+    {
+        fprintf(stderr, "%s: --follow and index lookups don't save checkpoints, ignoring --checkpoint\n", argv[0]);
+        checkpointName = nullptr;
+    }
+
+    // The output of a resumed run is cut back to where it was at the checkpoint and carries on from there
+    if(checkpointName && nullptr == outputName)
+    {
+        fprintf(stderr, "%s: --checkpoint needs -o\n", argv[0]);
+        return -1;
+    }
+
+    bResume = checkpointName && mptsCheckpoint::exists(checkpointName);
+
     util::setXmlOutput(xmlOut);
 
+    if(outputName)
+    {
+        pOutputFile = fopen(outputName, bResume ? "r+b" : "wb");
+
+        if(nullptr == pOutputFile)
+        {
+            fprintf(stderr, "%s: Can't open output file %s\n", argv[0], outputName);
+            return -1;
+        }
+
+        util::setXmlFile(pOutputFile);
+    }
+
     mptsParser mpts(filePosition);
     mpts.setTerse(bTerse);
     mpts.setAnalyzeElementaryStream(bAnalyzeElementaryStream);
+    mpts.setPidFilter(pidFilter);
+    mpts.setCheckContinuity(bContinuity);
+    mpts.setAnalyzePcr(bPcr);
+    mpts.setStatsOnly(bStats);
+    mpts.setSkipRepeatedTables(false == bAllTables);
+    mpts.setRecordWriter(pRecords.get());
 
     uint8_t *packetBuffer, *packet;
 	uint16_t programMapPid = 0;
@@ -87,37 +422,59 @@ int main(int argc, char* argv[])
     int64_t totalRead = 0;
     int64_t readBlockSize = 0;
 
-	FILE *inputFile = nullptr;
-	inputFile = fopen(argv[argc - 1], "rb");
+    std::unique_ptr<mptsReader> pReader;
+
+    if(bMemoryMap)
+    {
+        pReader.reset(new mmapReader);
+
+        if(false == pReader->open(argv[argc - 1]))
+        {
+            fprintf(stderr, "%s: Can't memory map input file, falling back to buffered reads\n", argv[0]);
+            pReader.reset();
+        }
+    }
 
-	if (nullptr == inputFile)
+    if(nullptr == pReader)
     {
-        fprintf(stderr, "%s: Can't open input file", argv[0]);
-		return -1;
+        if(bAsyncRead)
+            pReader.reset(new asyncReader(queueDepth));
+        else
+            pReader.reset(new freadReader);
+
+        if(false == pReader->open(argv[argc - 1]))
+        {
+            fprintf(stderr, "%s: Can't open input file", argv[0]);
+            return -1;
+        }
     }
 
-    // Determine the size of the file
-    int64_t fileSize = 0;
+    int64_t fileSize = pReader->getFileSize();
+
+    bool bRange = rangeStart >= 0 || rangeEnd >= 0 || startSeconds >= 0. || endSeconds >= 0.;
 
-#ifdef WINDOWS
-    struct __stat64 stat64Buf;
-    _stat64(argv[argc - 1], &stat64Buf);
-    fileSize = stat64Buf.st_size;
-#else
-    fseek(inputFile, 0L, SEEK_END);
-    fileSize = ftell(inputFile);
-    fseek(inputFile, 0L, SEEK_SET);
-#endif
+    if(bRange && -1 == fileSize)
+    {
+        fprintf(stderr, "%s: --start, --end, --start-time and --end-time need a file it can seek in\n", argv[0]);
+        return -1;
+    }
+
+    if(checkpointName && -1 == fileSize)
+    {
+        fprintf(stderr, "%s: --checkpoint needs a file it can seek in\n", argv[0]);
+        return -1;
+    }
 
     // Need to determine packet size.
     // Standard is 188, but digital video cameras add a 4 byte timecode
     // before the 188 byte packet, making the packet size 192.
+    // DVB captures may carry 16 Reed-Solomon parity bytes after it, making it 204.
     // https://en.wikipedia.org/wiki/MPEG_transport_stream
 
-    uint8_t tempBuffer[5];
-    fread(tempBuffer, 1, 5, inputFile);
+    uint8_t tempBuffer[SYNC_SNIFF_SIZE] = { 0 };
+    size_t sniffSize = pReader->peek(tempBuffer, sizeof(tempBuffer));
 
-    int packetSize = mpts.determine_packet_size(tempBuffer);
+    int packetSize = mpts.determine_packet_size(tempBuffer, sniffSize);
 
     if(-1 == packetSize)
     {
@@ -125,83 +482,306 @@ int main(int argc, char* argv[])
         return -1;
     }
 
-    // Go back to the beginning of the file
-    fseek(inputFile, 0L, SEEK_SET);
+    if(0 == blockPackets)
+        blockPackets = 1;
 
-    if(fileSize > 10000*(int64_t)packetSize)
-        readBlockSize = 10000*(int64_t)packetSize;
+    // A pipe has no known size, just use full blocks. So does a file that is still growing.
+    if(fileSize > (int64_t)blockPackets*packetSize || -1 == fileSize || bFollow)
+        readBlockSize = (int64_t)blockPackets*packetSize;
     else
         readBlockSize = fileSize;
 
-    packetBuffer = new uint8_t[readBlockSize];
+    pReader->setBlockSize(readBlockSize);
 
-    // Read each 188 byte packet and process the packet
-	packetBufferSize = fread(packetBuffer, 1, readBlockSize, inputFile);
-    packet = packetBuffer;
-
-    util::printfXml(0, "<?xml version = \"1.0\" encoding = \"UTF-8\"?>\n");
-    util::printfXml(0, "<file>\n");
-    util::printfXml(1, "<name>%s</name>\n", argv[argc - 1]);
-    util::printfXml(1, "<file_size>%llu</file_size>\n", fileSize);
-    util::printfXml(1, "<packet_size>%d</packet_size>\n", packetSize);
-    if(bTerse)
-        util::printfXml(1, "<terse>1</terse>\n");
-    else
-        util::printfXml(1, "<terse>0</terse>\n");
+    mptsIndex index;
+    bool bIndexQuery = bIndexSummary || frameQuery >= 0 || ptsQuery >= 0;
+
+    if(bIndexQuery || startFrame >= 0 || endFrame >= 0)
+    {
+        if(-1 == fileSize)
+        {
+            fprintf(stderr, "%s: The frame index needs a file it can seek in\n", argv[0]);
+            return -1;
+        }
+
+        if(false == index.load(argv[argc - 1]) &&
+           false == index.build(argv[argc - 1], fileSize, packetSize, readBlockSize, jobs, bMemoryMap, bProgress))
+        {
+            fprintf(stderr, "%s: Can't build the index %s\n", argv[0], mptsIndex::getIndexName(argv[argc - 1]).c_str());
+            return -1;
+        }
+
+        const mptsIndexEntry *pStart = (startFrame >= 0) ? index.findFrame(startFrame) : nullptr;
+        const mptsIndexEntry *pEnd = (endFrame >= 0) ? index.findFrame(endFrame) : nullptr;
+
+        if((startFrame >= 0 && nullptr == pStart) || (endFrame >= 0 && nullptr == pEnd))
+        {
+            fprintf(stderr, "%s: The file has %zu frames\n", argv[0], index.getFrameCount());
+            return -1;
+        }
+
+        // The range starts at the first packet of the start frame and stops where the frame after the end frame starts
+        if(pStart)
+            rangeStart = pStart->position;
+
+        if(pEnd && index.findFrame(endFrame + 1))
+            rangeEnd = index.findFrame(endFrame + 1)->position;
+
+        bRange = true;
+    }
+
+    // Started here, every return from now on goes through closeOutput()
+    if(bAsyncWrite)
+    {
+        pWriter.reset(new asyncWriter(util::getXmlFile()));
+        util::setXmlWriter(pWriter.get());
+    }
+
+    // A resumed run's output already starts with all this
+    if(false == bResume)
+    {
+        util::printfXml(0, "<?xml version = \"1.0\" encoding = \"UTF-8\"?>\n");
+        util::printfXml(0, "<file>\n");
+        util::printfXml(1, "<name>%s</name>\n", argv[argc - 1]);
+        if(-1 != fileSize)
+            util::printfXml(1, "<file_size>%llu</file_size>\n", fileSize);
+        util::printfXml(1, "<packet_size>%d</packet_size>\n", packetSize);
+        if(bTerse)
+            util::printfXml(1, "<terse>1</terse>\n");
+        else
+            util::printfXml(1, "<terse>0</terse>\n");
+
+        if(pRecords)
+            pRecords->begin(argv[argc - 1], fileSize, packetSize);
+    }
+
+    // Index lookups don't parse the file at all
+    if(bIndexQuery)
+    {
+        if(bIndexSummary)
+            index.printSummary();
+
+        if(frameQuery >= 0 && index.findFrame(frameQuery))
+            index.printFrame(*index.findFrame(frameQuery));
+        else if(frameQuery >= 0)
+            util::printfXml(1, "<error>There is no frame %lld, the file has %zu</error>\n", frameQuery, index.getFrameCount());
+
+        int ptsPid = pidFilter.empty() ? -1 : pidFilter[0];
+
+        if(ptsQuery >= 0 && index.findPts(ptsQuery, ptsPid))
+            index.printFrame(*index.findPts(ptsQuery, ptsPid));
+        else if(ptsQuery >= 0)
+            util::printfXml(1, "<error>No frame is shown at PTS %lld</error>\n", ptsQuery);
+
+        util::printfXml(0, "</file>\n");
+        closeOutput(pOutputFile, pWriter.get());
+
+        return 0;
+    }
+
+    // The PAT and PMT are still parsed for --stats, but only its summary is printed
+    if(bStats)
+        util::setXmlOutput(false);
+
+    if(bFollow && bRange)
+    {
+        fprintf(stderr, "%s: --follow always parses from the start of the file\n", argv[0]);
+        bRange = false;
+        rangeStart = rangeEnd = -1;
+        startSeconds = endSeconds = -1.;
+    }
+
+    if(bFollow && jobs > 1)
+    {
+        fprintf(stderr, "%s: --follow parses on a single thread\n", argv[0]);
+        jobs = 1;
+    }
+
+    if(jobs > 1 && -1 == fileSize)
+    {
+        fprintf(stderr, "%s: -j needs a file it can seek in, parsing on a single thread\n", argv[0]);
+        jobs = 1;
+    }
+
+    // Checkpoints are saved between the chunks of mptsParallel
+    if(jobs > 1 || bRange || checkpointName)
+    {
+        // Every thread opens the file for itself
+        pReader->close();
+
+        mptsParallel parallel(argv[argc - 1], fileSize, packetSize, readBlockSize);
+        parallel.setTerse(bTerse);
+        parallel.setAnalyzeElementaryStream(bAnalyzeElementaryStream);
+        parallel.setMemoryMap(bMemoryMap);
+        parallel.setProgress(bProgress);
+        parallel.setPidFilter(pidFilter);
+        parallel.setCheckContinuity(bContinuity);
+        parallel.setAnalyzePcr(bPcr);
+        parallel.setStatsOnly(bStats);
+        parallel.setSkipRepeatedTables(false == bAllTables);
+        parallel.setRecordWriter(pRecords.get());
+        parallel.setRange(rangeStart, rangeEnd);
+        parallel.setTimeRange(startSeconds, endSeconds);
+
+        if(startFrame >= 0)
+            parallel.setFirstFrameNumber((unsigned int) startFrame);
+
+        if(checkpointName)
+            parallel.setCheckpoint(checkpointName, checkpointSeconds, getCheckpointOptions(argc, argv));
+
+        int64_t outputSize = 0;
+
+        if(bResume && (false == parallel.resumeCheckpoint(outputSize) || false == mptsCheckpoint::truncate(pOutputFile, outputSize)))
+        {
+            fprintf(stderr, "%s: The checkpoint %s doesn't belong to this input, these options or this output, remove it to start over\n", argv[0], checkpointName);
+            closeOutput(pOutputFile, pWriter.get());
+            return -1;
+        }
+
+        bool bParsed = parallel.run(jobs);
+
+        util::setXmlOutput(xmlOut);
+
+        if(bParsed)
+        {
+            if(parallel.getStats())
+                parallel.getStats()->print();
+
+            if(bTableRepeats && parallel.getTables())
+                parallel.getTables()->print();
+
+            if(parallel.getContinuity())
+                printContinuity(argv[0], *parallel.getContinuity());
+
+            if(parallel.getPcr())
+                parallel.getPcr()->print();
+
+            printSyncLoss(argv[0], parallel.getLostBytes(), parallel.getResyncCount(), parallel.getLosses());
+            printSkippedSections(parallel.getSkippedSectionCount());
+
+            if(bProgress && bAnalyzeElementaryStream)
+                printBufferStats(parallel.getBufferHighWaterMark(), parallel.getBufferAllocationCount());
+        }
+        else
+            fprintf(stderr, "%s: Failed to parse the input file\n", argv[0]);
+
+        util::printfXml(0, "</file>\n");
+        closeOutput(pOutputFile, pWriter.get());
+
+        // Only now is the output complete
+        if(bParsed && checkpointName)
+            parallel.removeCheckpoint();
+
+        if(bProgress && pWriter)
+            printWriterStats(*pWriter);
+
+        return 0;
+    }
 
     float step = 1.f;
     float nextStep = 0.f;
     float progress = 0.f;
 
-    // Send one packet at a time into the mpts_parser
-	while((size_t) (packet - packetBuffer) < packetBufferSize)
-	{
-        int err = 0;
+    // When reading from a pipe the total is unknown, so report throughput instead of percent
+    auto startTime = std::chrono::steady_clock::now();
+    int64_t nextReport = 0;
 
-//        if(packetNum == 88892)
-//            __debugbreak();
+    // mptsSync finds the packet boundaries in each block and skips over corrupt data
+    mptsSync sync(packetSize);
+    size_t runCount = 0;
+    int64_t runOffset = 0;
 
-        if(192 == packetSize)
-            err = mpts.processPacket(packet + 4, packetNum);
-        else
-            err = mpts.processPacket(packet, packetNum);
+    // Read each 188 byte packet and process the packet
+	packetBufferSize = pReader->read(packetBuffer);
 
-        if(0 != err)
-            goto error;
+    // Send each run of packets into the mpts_parser in one call.
+    // The final, empty, block lets the sync engine flush the packets it is still holding.
+	for(;;)
+	{
+        sync.setBlock(packetBuffer, packetBufferSize);
 
-        totalRead += packetSize;
-        filePosition = totalRead;
+        // Frames are then gathered without copying their payloads
+        if(pReader->isPinned())
+            mpts.setPinnedBlock(packetBuffer, packetBufferSize);
 
-        if(bProgress)
+        while(sync.nextRun(packet, runCount, runOffset))
         {
-            if(progress >= nextStep)
+            int err = 0;
+
+            filePosition = runOffset;
+
+            err = mpts.processPackets(packet, runCount, packetSize, packetNum);
+
+            if(0 != err)
+                goto error;
+
+            packetNum += runCount;
+            totalRead = runOffset + runCount * packetSize;
+
+            if(bProgress && (-1 == fileSize || bFollow))
             {
-                fprintf(stderr, "Total bytes processed: %llu, %2.2f%%\r", totalRead, progress);
-                nextStep += step;
+                if(totalRead >= nextReport)
+                {
+                    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+                    double rate = elapsed.count() > 0. ? (double)totalRead / elapsed.count() : 0.;
+                    fprintf(stderr, "Total bytes processed: %llu, %.2f MB/s\r", (unsigned long long) totalRead, rate / (1024. * 1024.));
+                    nextReport += readBlockSize;
+                }
             }
+            else if(bProgress)
+            {
+                if(progress >= nextStep)
+                {
+                    fprintf(stderr, "Total bytes processed: %llu, %2.2f%%\r", (unsigned long long) totalRead, progress);
+                    nextStep += step;
+                }
 
-            progress = ((float)totalRead / (float)fileSize) * 100.f;
+                progress = ((float)totalRead / (float)fileSize) * 100.f;
+            }
         }
 
-        if(0 == (totalRead % readBlockSize))
-        {
-            packetBufferSize = fread(packetBuffer, 1, readBlockSize, inputFile);
-            packet = packetBuffer;
-        }
-        else
-            packet += packetSize;
+        if(0 == packetBufferSize)
+            break;
+
+        packetBufferSize = pReader->read(packetBuffer);
 
-        packetNum++;
+        // The last block goes to mptsSync empty only once following the file is over
+        if(0 == packetBufferSize && bFollow)
+            packetBufferSize = waitForInput(*pReader, packetBuffer, followSeconds);
     }
 
+    sync.finish();
     mpts.flush();
 
+    util::setXmlOutput(xmlOut);
+
+    if(mpts.getStats())
+        mpts.getStats()->print();
+
+    if(bTableRepeats && mpts.getTables())
+        mpts.getTables()->print();
+
+    if(mpts.getContinuity())
+        printContinuity(argv[0], *mpts.getContinuity());
+
+    if(mpts.getPcr())
+        mpts.getPcr()->print();
+
+    printSyncLoss(argv[0], sync.getLostBytes(), sync.getResyncCount(), sync.getLosses());
+    printSkippedSections(mpts.getSkippedSectionCount());
+
+    if(bProgress && bAnalyzeElementaryStream)
+        printBufferStats(mpts.getBufferPool().getHighWaterMark(), mpts.getBufferPool().getAllocationCount());
+
 error:
+    util::setXmlOutput(xmlOut);
     util::printfXml(0, "</file>\n");
+    closeOutput(pOutputFile, pWriter.get());
 
-    delete [] packetBuffer;
+    if(bProgress && pWriter)
+        printWriterStats(*pWriter);
 
-	fclose(inputFile);
+    pReader->close();
 
 	return 0;
 }
@@ -0,0 +1,262 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifdef WINDOWS
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "mpts_checkpoint.h"
+#include "mpts_records.h"
+
+// Nothing but a damaged checkpoint has a string or byte array this long
+#define CHECKPOINT_MAX_BYTES (64 * 1024 * 1024)
+
+mptsCheckpoint::mptsCheckpoint()
+    : m_pFile(nullptr)
+    , m_bGood(false)
+{
+}
+
+mptsCheckpoint::~mptsCheckpoint()
+{
+    close();
+}
+
+bool mptsCheckpoint::exists(const char *fileName)
+{
+    FILE *pFile = fopen(fileName, "rb");
+
+    if(nullptr == pFile)
+        return false;
+
+    fclose(pFile);
+    return true;
+}
+
+bool mptsCheckpoint::create(const char *fileName)
+{
+    close();
+
+    m_fileName = fileName;
+    m_pFile = fopen((m_fileName + ".tmp").c_str(), "wb");
+    m_bGood = (nullptr != m_pFile);
+
+    if(m_bGood)
+        m_bGood = (1 == fwrite(MPTS_CHECKPOINT_MAGIC, 8, 1, m_pFile));
+
+    return m_bGood;
+}
+
+bool mptsCheckpoint::commit()
+{
+    if(nullptr == m_pFile)
+        return false;
+
+    std::string tempName = m_fileName + ".tmp";
+
+    // On the disk before it takes the place of the last one
+    if(m_bGood)
+        m_bGood = sync(m_pFile);
+
+    if(0 != fclose(m_pFile))
+        m_bGood = false;
+
+    m_pFile = nullptr;
+
+    // Replaced in one step, a stop while this runs leaves either the last checkpoint or the new one
+    if(m_bGood)
+    {
+#ifdef WINDOWS
+        m_bGood = (0 != MoveFileExA(tempName.c_str(), m_fileName.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH));
+#else
+        m_bGood = (0 == rename(tempName.c_str(), m_fileName.c_str()));
+#endif
+    }
+
+    if(false == m_bGood)
+        remove(tempName.c_str());
+
+    return m_bGood;
+}
+
+bool mptsCheckpoint::open(const char *fileName)
+{
+    close();
+
+    m_fileName = fileName;
+    m_pFile = fopen(fileName, "rb");
+    m_bGood = (nullptr != m_pFile);
+
+    char magic[8] = { 0 };
+
+    if(m_bGood)
+        m_bGood = (1 == fread(magic, 8, 1, m_pFile) && 0 == memcmp(magic, MPTS_CHECKPOINT_MAGIC, 8));
+
+    return m_bGood;
+}
+
+void mptsCheckpoint::close()
+{
+    if(m_pFile)
+    {
+        fclose(m_pFile);
+        m_pFile = nullptr;
+    }
+}
+
+void mptsCheckpoint::put(uint64_t value)
+{
+    uint8_t bytes[8];
+
+    util::writeLittleEndian(bytes, value, 8);
+
+    if(m_bGood && 1 != fwrite(bytes, 8, 1, m_pFile))
+        m_bGood = false;
+}
+
+void mptsCheckpoint::put(const std::string &value)
+{
+    put((uint64_t) value.size());
+
+    if(m_bGood && value.size() && 1 != fwrite(value.data(), value.size(), 1, m_pFile))
+        m_bGood = false;
+}
+
+void mptsCheckpoint::put(const std::vector<uint8_t> &value)
+{
+    put((uint64_t) value.size());
+
+    if(m_bGood && value.size() && 1 != fwrite(value.data(), value.size(), 1, m_pFile))
+        m_bGood = false;
+}
+
+// Doubles go as their bits
+void mptsCheckpoint::putDouble(double value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    put(bits);
+}
+
+bool mptsCheckpoint::getBytes(uint8_t *p, size_t size)
+{
+    if(m_bGood && size && 1 != fread(p, size, 1, m_pFile))
+        m_bGood = false;
+
+    return m_bGood;
+}
+
+uint64_t mptsCheckpoint::get()
+{
+    uint8_t bytes[8];
+
+    if(false == getBytes(bytes, 8))
+        return 0;
+
+    return util::readLittleEndian(bytes, 8);
+}
+
+double mptsCheckpoint::getDouble()
+{
+    uint64_t bits = get();
+    double value;
+
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+std::string mptsCheckpoint::getString()
+{
+    std::vector<uint8_t> bytes = getBytes();
+
+    return std::string(bytes.begin(), bytes.end());
+}
+
+std::vector<uint8_t> mptsCheckpoint::getBytes()
+{
+    uint64_t size = get();
+
+    if(size > CHECKPOINT_MAX_BYTES)
+        m_bGood = false;
+
+    if(false == m_bGood)
+        return std::vector<uint8_t>();
+
+    std::vector<uint8_t> bytes((size_t) size);
+
+    if(false == getBytes(bytes.data(), bytes.size()))
+        bytes.clear();
+
+    return bytes;
+}
+
+bool mptsCheckpoint::sync(FILE *pFile)
+{
+    if(0 != fflush(pFile))
+        return false;
+
+#ifdef WINDOWS
+    return 0 == _commit(_fileno(pFile));
+#else
+    return 0 == fsync(fileno(pFile));
+#endif
+}
+
+int64_t mptsCheckpoint::tell(FILE *pFile)
+{
+    fflush(pFile);
+
+#ifdef WINDOWS
+    return _ftelli64(pFile);
+#else
+    return ftello(pFile);
+#endif
+}
+
+bool mptsCheckpoint::truncate(FILE *pFile, int64_t size)
+{
+    // Something went missing from the end of the file since the checkpoint
+    if(0 != fseek(pFile, 0, SEEK_END) || tell(pFile) < size)
+        return false;
+
+#ifdef WINDOWS
+    if(0 != _chsize_s(_fileno(pFile), size) || 0 != _fseeki64(pFile, size, SEEK_SET))
+        return false;
+#else
+    if(0 != ftruncate(fileno(pFile), (off_t) size) || 0 != fseeko(pFile, size, SEEK_SET))
+        return false;
+#endif
+
+    return true;
+}
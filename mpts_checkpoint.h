@@ -0,0 +1,97 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// The state of a parse between two chunks, saved every so often with --checkpoint so a run
+// that was stopped can go on from the last checkpoint instead of from the start.
+// See mptsParallel::setCheckpoint().
+//
+// A checkpoint is MPTS_CHECKPOINT_MAGIC followed by the values put() into it, 8 little endian
+// bytes each, with strings and byte arrays as their size followed by their bytes.
+// It is written to <name>.tmp first, and only takes the place of the last one once complete and on the disk.
+// With --pcr the PCR windows closed so far are kept beside it, in <name>.pcr, and it holds their size.
+
+#define MPTS_CHECKPOINT_MAGIC "MPTSCKP1"
+
+// Seconds between checkpoints, when --checkpoint-interval isn't given
+#define CHECKPOINT_INTERVAL 60.
+
+// While checkpoints are saved no chunk is bigger than this, so there is a chance to save one every so often
+#define CHECKPOINT_CHUNK_SIZE (64 * 1024 * 1024)
+
+// Added to the name of a checkpoint for the file of the PCR windows, see mptsPcr::keepWindows()
+#define CHECKPOINT_PCR_SUFFIX ".pcr"
+
+class mptsCheckpoint
+{
+public:
+    mptsCheckpoint();
+    ~mptsCheckpoint();
+
+    static bool exists(const char *fileName);
+
+    // Start a new checkpoint, commit() puts it in place of the old one
+    bool create(const char *fileName);
+    bool commit();
+
+    // Read the checkpoint in fileName from its start
+    bool open(const char *fileName);
+    void close();
+
+    // False once a put() or get() failed, or a get() ran past the end
+    bool isGood() const { return m_bGood; }
+
+    void put(uint64_t value);
+    void put(const std::string &value);
+    void put(const std::vector<uint8_t> &value);
+    void putDouble(double value);
+
+    uint64_t get();
+    std::string getString();
+    std::vector<uint8_t> getBytes();
+    double getDouble();
+
+    // Write what is buffered for a file and wait until it is on the disk
+    static bool sync(FILE *pFile);
+
+    // The size of a file written up to now, and cutting it back to size to write on from there.
+    // truncate() fails when the file is shorter than size.
+    static int64_t tell(FILE *pFile);
+    static bool truncate(FILE *pFile, int64_t size);
+
+private:
+    bool getBytes(uint8_t *p, size_t size);
+
+    FILE *m_pFile;
+    std::string m_fileName;
+    bool m_bGood;
+};
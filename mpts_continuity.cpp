@@ -0,0 +1,294 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#include <cstdint>
+#include <cstring>
+#include "mpts_continuity.h"
+#include "mpts_checkpoint.h"
+#include "util.h"
+
+mptsContinuity::mptsContinuity()
+    : m_pids(0x2000)
+    , m_total{}
+{
+}
+
+void mptsContinuity::addError(int64_t fileOffset, uint16_t pid, eContinuityErrorType type, uint8_t expected, uint8_t found)
+{
+    if(m_errors.size() < CONTINUITY_MAX_RECORDED_ERRORS)
+        m_errors.emplace_back(fileOffset, pid, type, expected, found);
+}
+
+void mptsContinuity::checkCounter(pidState &state, uint16_t pid, uint8_t counter, int64_t fileOffset)
+{
+    uint8_t expected = (state.lastCounter + 1) & 0x0F;
+
+    if(counter == expected)
+    {
+        state.bDuplicate = false;
+    }
+    else if(counter == state.lastCounter && false == state.bDuplicate)
+    {
+        state.count.duplicates++;
+        m_total.duplicates++;
+        state.bDuplicate = true;
+    }
+    else
+    {
+        state.count.losses++;
+        m_total.losses++;
+        state.bDuplicate = false;
+
+        addError(fileOffset, pid, counter == state.lastCounter ? eContinuityDuplicate : eContinuityLoss, expected, counter);
+    }
+
+    state.lastCounter = counter;
+}
+
+void mptsContinuity::check(const mptsHeaders &headers, const uint8_t *packets, unsigned int stride, int64_t fileOffset)
+{
+    for(size_t i = 0; i < headers.size(); i++, packets += stride, fileOffset += stride)
+    {
+        uint16_t pid = headers.pid[i];
+        uint8_t flags = headers.flags[i];
+        pidState &state = m_pids[pid];
+
+        state.count.packets++;
+        m_total.packets++;
+
+        if(headers.scramblingControl[i])
+        {
+            state.count.scrambled++;
+            m_total.scrambled++;
+        }
+
+        if(flags & eHeaderTransportError)
+        {
+            state.count.transportErrors++;
+            m_total.transportErrors++;
+            addError(fileOffset, pid, eContinuityTransportError, 0, 0);
+            continue;
+        }
+
+        // Null packets have no counter, and it only goes up with a payload
+        uint8_t adaptationFieldControl = headers.adaptationFieldControl[i];
+
+        if(0x1FFF == pid || 0 == (adaptationFieldControl & 0x01))
+            continue;
+
+        uint8_t counter = headers.continuityCounter[i];
+        bool bDiscontinuity = (adaptationFieldControl & 0x02) && packets[4] && (packets[5] & 0x80);
+
+        if(false == state.bHaveCounter)
+        {
+            state.firstOffset = fileOffset;
+            state.firstCounter = counter;
+            state.bFirstDiscontinuity = bDiscontinuity;
+            state.bHaveCounter = true;
+            state.bDuplicate = false;
+            state.lastCounter = counter;
+        }
+        else if(bDiscontinuity)
+        {
+            state.bDuplicate = false;
+            state.lastCounter = counter;
+        }
+        else
+        {
+            checkCounter(state, pid, counter, fileOffset);
+        }
+    }
+}
+
+void mptsContinuity::append(const mptsContinuity &next)
+{
+    // Errors found at the join come before any the next part found
+    for(uint16_t pid = 0; pid < 0x2000; pid++)
+    {
+        pidState &state = m_pids[pid];
+        const pidState &nextState = next.m_pids[pid];
+
+        if(state.bHaveCounter && nextState.bHaveCounter && false == nextState.bFirstDiscontinuity)
+            checkCounter(state, pid, nextState.firstCounter, nextState.firstOffset);
+    }
+
+    for(const auto &error : next.m_errors)
+        addError(error.fileOffset, error.pid, error.type, error.expected, error.found);
+
+    for(uint16_t pid = 0; pid < 0x2000; pid++)
+    {
+        pidState &state = m_pids[pid];
+        const pidState &nextState = next.m_pids[pid];
+
+        state.count.packets += nextState.count.packets;
+        state.count.losses += nextState.count.losses;
+        state.count.duplicates += nextState.count.duplicates;
+        state.count.transportErrors += nextState.count.transportErrors;
+        state.count.scrambled += nextState.count.scrambled;
+
+        if(nextState.bHaveCounter)
+        {
+            if(false == state.bHaveCounter)
+            {
+                state.firstOffset = nextState.firstOffset;
+                state.firstCounter = nextState.firstCounter;
+                state.bFirstDiscontinuity = nextState.bFirstDiscontinuity;
+                state.bHaveCounter = true;
+            }
+
+            state.lastCounter = nextState.lastCounter;
+            state.bDuplicate = nextState.bDuplicate;
+        }
+    }
+
+    m_total.packets += next.m_total.packets;
+    m_total.losses += next.m_total.losses;
+    m_total.duplicates += next.m_total.duplicates;
+    m_total.transportErrors += next.m_total.transportErrors;
+    m_total.scrambled += next.m_total.scrambled;
+}
+
+void mptsContinuity::saveCounts(mptsCheckpoint &checkpoint, const counts &count)
+{
+    checkpoint.put(count.packets);
+    checkpoint.put(count.losses);
+    checkpoint.put(count.duplicates);
+    checkpoint.put(count.transportErrors);
+    checkpoint.put(count.scrambled);
+}
+
+void mptsContinuity::loadCounts(mptsCheckpoint &checkpoint, counts &count)
+{
+    count.packets = checkpoint.get();
+    count.losses = checkpoint.get();
+    count.duplicates = checkpoint.get();
+    count.transportErrors = checkpoint.get();
+    count.scrambled = checkpoint.get();
+}
+
+// Only the PIDs that had packets
+void mptsContinuity::save(mptsCheckpoint &checkpoint) const
+{
+    uint64_t seen = 0;
+
+    for(const pidState &state : m_pids)
+    {
+        if(state.count.packets)
+            seen++;
+    }
+
+    saveCounts(checkpoint, m_total);
+    checkpoint.put(seen);
+
+    for(size_t pid = 0; pid < m_pids.size(); pid++)
+    {
+        const pidState &state = m_pids[pid];
+
+        if(0 == state.count.packets)
+            continue;
+
+        checkpoint.put(pid);
+        saveCounts(checkpoint, state.count);
+        checkpoint.put((uint64_t) state.firstOffset);
+        checkpoint.put(state.firstCounter);
+        checkpoint.put(state.bFirstDiscontinuity);
+        checkpoint.put(state.bHaveCounter);
+        checkpoint.put(state.bDuplicate);
+        checkpoint.put(state.lastCounter);
+    }
+
+    checkpoint.put(m_errors.size());
+
+    for(const continuityError &error : m_errors)
+    {
+        checkpoint.put((uint64_t) error.fileOffset);
+        checkpoint.put(error.pid);
+        checkpoint.put(error.type);
+        checkpoint.put(error.expected);
+        checkpoint.put(error.found);
+    }
+}
+
+void mptsContinuity::load(mptsCheckpoint &checkpoint)
+{
+    loadCounts(checkpoint, m_total);
+
+    uint64_t seen = checkpoint.get();
+
+    for(uint64_t i = 0; i < seen && checkpoint.isGood(); i++)
+    {
+        pidState &state = m_pids[checkpoint.get() & 0x1FFF];
+
+        loadCounts(checkpoint, state.count);
+        state.firstOffset = (int64_t) checkpoint.get();
+        state.firstCounter = (uint8_t) checkpoint.get();
+        state.bFirstDiscontinuity = 0 != checkpoint.get();
+        state.bHaveCounter = 0 != checkpoint.get();
+        state.bDuplicate = 0 != checkpoint.get();
+        state.lastCounter = (uint8_t) checkpoint.get();
+    }
+
+    uint64_t errors = checkpoint.get();
+
+    m_errors.clear();
+
+    for(uint64_t i = 0; i < errors && checkpoint.isGood(); i++)
+    {
+        int64_t fileOffset = (int64_t) checkpoint.get();
+        uint16_t pid = (uint16_t) checkpoint.get();
+        eContinuityErrorType type = (eContinuityErrorType) checkpoint.get();
+        uint8_t expected = (uint8_t) checkpoint.get();
+        uint8_t found = (uint8_t) checkpoint.get();
+
+        addError(fileOffset, pid, type, expected, found);
+    }
+}
+
+void mptsContinuity::print() const
+{
+    static const char *errorNames[] = { "loss", "duplicate", "transport_error" };
+
+    util::printfXml(1, "<continuity packets=\"%llu\" cc_errors=\"%llu\" duplicates=\"%llu\" transport_errors=\"%llu\" scrambled=\"%llu\">\n",
+        m_total.packets, m_total.losses, m_total.duplicates, m_total.transportErrors, m_total.scrambled);
+
+    for(uint16_t pid = 0; pid < 0x2000; pid++)
+    {
+        const counts &count = m_pids[pid].count;
+
+        if(count.packets)
+        {
+            util::printfXml(2, "<pid number=\"0x%x\" packets=\"%llu\" cc_errors=\"%llu\" duplicates=\"%llu\" transport_errors=\"%llu\" scrambled=\"%llu\"/>\n",
+                pid, count.packets, count.losses, count.duplicates, count.transportErrors, count.scrambled);
+        }
+    }
+
+    for(const auto &error : m_errors)
+    {
+        util::printfXml(2, "<error start=\"%lld\" pid=\"0x%x\" type=\"%s\" expected=\"%d\" found=\"%d\"/>\n",
+            error.fileOffset, error.pid, errorNames[error.type], error.expected, error.found);
+    }
+
+    util::printfXml(1, "</continuity>\n");
+}
@@ -0,0 +1,120 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "mpts_headers.h"
+
+class mptsCheckpoint;
+
+// Only the first few errors are kept with their position, the rest are just counted
+#define CONTINUITY_MAX_RECORDED_ERRORS 32
+
+enum eContinuityErrorType
+{
+    eContinuityLoss,        // The counter skipped, packets were lost
+    eContinuityDuplicate,   // The same counter more than twice in a row
+    eContinuityTransportError
+};
+
+struct continuityError
+{
+    continuityError(int64_t fileOffset, uint16_t pid, eContinuityErrorType type, uint8_t expected, uint8_t found)
+        : fileOffset(fileOffset)
+        , pid(pid)
+        , type(type)
+        , expected(expected)
+        , found(found) {}
+
+    int64_t fileOffset;
+    uint16_t pid;
+    eContinuityErrorType type;
+    uint8_t expected;
+    uint8_t found;
+};
+
+// Checks the continuity counter of every PID and counts transport error and scrambled packets,
+// in the spirit of the TR 101 290 priority 1 checks.
+//
+// The counter goes up by one with each packet that carries a payload. One repeat of a packet
+// is allowed and counted as a duplicate, a discontinuity_indicator in the adaptation field
+// starts the count again. Packets with transport_error_indicator set are not trusted for the counter.
+class mptsContinuity
+{
+public:
+    mptsContinuity();
+
+    // Check a batch of decoded headers, packets pointing at the first sync byte,
+    // stride bytes apart, and fileOffset being the position of the first packet's stride
+    void check(const mptsHeaders &headers, const uint8_t *packets, unsigned int stride, int64_t fileOffset);
+
+    // Add the counts of the part of the stream that comes straight after this one,
+    // checking the counters across the join
+    void append(const mptsContinuity &next);
+
+    // Save what append() needs to carry on from here, and load it back into a new object, see mpts_checkpoint.h
+    void save(mptsCheckpoint &checkpoint) const;
+    void load(mptsCheckpoint &checkpoint);
+
+    // Write the totals, the counts of each PID seen, and the recorded errors as xml
+    void print() const;
+
+    uint64_t getPacketCount() const { return m_total.packets; }
+    uint64_t getErrorCount() const { return m_total.losses + m_total.transportErrors; }
+    const std::vector<continuityError> &getErrors() const { return m_errors; }
+
+private:
+    struct counts
+    {
+        uint64_t packets;
+        uint64_t losses;
+        uint64_t duplicates;
+        uint64_t transportErrors;
+        uint64_t scrambled;
+    };
+
+    struct pidState
+    {
+        counts count;
+        int64_t firstOffset;    // The first packet with a payload, for checking across a join
+        uint8_t firstCounter;
+        bool bFirstDiscontinuity;
+        bool bHaveCounter;      // A packet with a payload has been seen
+        bool bDuplicate;        // The last packet repeated the one before
+        uint8_t lastCounter;
+    };
+
+    void addError(int64_t fileOffset, uint16_t pid, eContinuityErrorType type, uint8_t expected, uint8_t found);
+    void checkCounter(pidState &state, uint16_t pid, uint8_t counter, int64_t fileOffset);
+    static void saveCounts(mptsCheckpoint &checkpoint, const counts &count);
+    static void loadCounts(mptsCheckpoint &checkpoint, counts &count);
+
+    std::vector<pidState> m_pids; // Indexed by PID
+    counts m_total;
+    std::vector<continuityError> m_errors;
+};
@@ -0,0 +1,143 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#include <cstdint>
+#include <cstring>
+#include "mpts_headers.h"
+#include "mpts_sync.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+mptsHeaders::mptsHeaders()
+    : m_count(0)
+{
+}
+
+void mptsHeaders::decodeScalar(const uint8_t *p, size_t first, size_t count, unsigned int stride)
+{
+    p += first * stride;
+
+    for(size_t i = first; i < count; i++, p += stride)
+    {
+        pid[i] = ((p[1] & 0x1F) << 8) | p[2];
+        flags[i] = (p[1] >> 5) | (SYNC_BYTE != p[0] ? eHeaderBadSync : 0);
+        scramblingControl[i] = (p[3] & 0xC0) >> 6;
+        adaptationFieldControl[i] = (p[3] & 0x30) >> 4;
+        continuityCounter[i] = p[3] & 0x0F;
+    }
+}
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+
+// The header as a little endian 32 bit word is b0 | b1 << 8 | b2 << 16 | b3 << 24,
+// so the fields come out of each lane with shifts and masks alone.
+// Narrowed to 16 and 8 bits with saturating packs, every field is small enough for them to be exact.
+static inline void storeFields(__m128i header, uint16_t *pid, uint8_t *flags, uint8_t *scrambling, uint8_t *adaptation, uint8_t *continuity)
+{
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    const __m128i sync = _mm_set1_epi32(0x47);
+
+    __m128i pidLanes = _mm_or_si128(_mm_and_si128(header, _mm_set1_epi32(0x1F00)), _mm_and_si128(_mm_srli_epi32(header, 16), byteMask));
+    __m128i badSync = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(header, byteMask), sync), _mm_set1_epi32(eHeaderBadSync));
+    __m128i flagLanes = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(header, 13), _mm_set1_epi32(0x07)), badSync);
+    __m128i scramblingLanes = _mm_srli_epi32(header, 30);
+    __m128i adaptationLanes = _mm_and_si128(_mm_srli_epi32(header, 28), _mm_set1_epi32(0x03));
+    __m128i continuityLanes = _mm_and_si128(_mm_srli_epi32(header, 24), _mm_set1_epi32(0x0F));
+
+    __m128i pid16 = _mm_packs_epi32(pidLanes, pidLanes);
+    __m128i flags8 = _mm_packus_epi16(_mm_packs_epi32(flagLanes, flagLanes), _mm_setzero_si128());
+    __m128i scrambling8 = _mm_packus_epi16(_mm_packs_epi32(scramblingLanes, scramblingLanes), _mm_setzero_si128());
+    __m128i adaptation8 = _mm_packus_epi16(_mm_packs_epi32(adaptationLanes, adaptationLanes), _mm_setzero_si128());
+    __m128i continuity8 = _mm_packus_epi16(_mm_packs_epi32(continuityLanes, continuityLanes), _mm_setzero_si128());
+
+    _mm_storel_epi64((__m128i *) pid, pid16);
+
+    uint32_t bytes;
+
+    bytes = _mm_cvtsi128_si32(flags8);
+    std::memcpy(flags, &bytes, 4);
+    bytes = _mm_cvtsi128_si32(scrambling8);
+    std::memcpy(scrambling, &bytes, 4);
+    bytes = _mm_cvtsi128_si32(adaptation8);
+    std::memcpy(adaptation, &bytes, 4);
+    bytes = _mm_cvtsi128_si32(continuity8);
+    std::memcpy(continuity, &bytes, 4);
+}
+
+#endif
+
+#if !defined(__AVX2__) && (defined(__SSE2__) || defined(_M_X64))
+
+static inline int32_t loadHeader(const uint8_t *p)
+{
+    int32_t header;
+    std::memcpy(&header, p, 4);
+    return header;
+}
+
+#endif
+
+void mptsHeaders::decode(const uint8_t *p, size_t count, unsigned int stride)
+{
+    if(pid.size() < count)
+    {
+        pid.resize(count);
+        flags.resize(count);
+        scramblingControl.resize(count);
+        adaptationFieldControl.resize(count);
+        continuityCounter.resize(count);
+    }
+
+    m_count = count;
+
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    // Eight headers per gather
+    const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256i headers = _mm256_i32gather_epi32((const int *) (p + i * stride), offsets, 1);
+
+        storeFields(_mm256_castsi256_si128(headers), &pid[i], &flags[i], &scramblingControl[i], &adaptationFieldControl[i], &continuityCounter[i]);
+        storeFields(_mm256_extracti128_si256(headers, 1), &pid[i + 4], &flags[i + 4], &scramblingControl[i + 4], &adaptationFieldControl[i + 4], &continuityCounter[i + 4]);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for(; i + 4 <= count; i += 4)
+    {
+        const uint8_t *packet = p + i * stride;
+        __m128i headers = _mm_setr_epi32(loadHeader(packet), loadHeader(packet + stride), loadHeader(packet + 2 * stride), loadHeader(packet + 3 * stride));
+
+        storeFields(headers, &pid[i], &flags[i], &scramblingControl[i], &adaptationFieldControl[i], &continuityCounter[i]);
+    }
+#endif
+
+    decodeScalar(p, i, count, stride);
+}
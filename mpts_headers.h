@@ -0,0 +1,66 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Packets whose headers are decoded in one go by processPackets()
+#define HEADER_BATCH_SIZE 1024
+
+// Bits of mptsHeaders::flags, the first three are where the header has them after shifting out the PID
+enum eMptsHeaderFlags
+{
+    eHeaderTransportPriority = 0x01,
+    eHeaderPayloadUnitStart = 0x02,
+    eHeaderTransportError = 0x04,
+    eHeaderBadSync = 0x08 // The packet does not start with 0x47
+};
+
+// The 4 byte headers of a run of transport stream packets, one array per field.
+// Decoded with AVX2 or SSE2 when the compiler targets them, a packet at a time otherwise.
+class mptsHeaders
+{
+public:
+    mptsHeaders();
+
+    // Decode count headers, packets being stride bytes apart and p pointing at the sync byte of the first
+    void decode(const uint8_t *p, size_t count, unsigned int stride);
+
+    size_t size() const { return m_count; }
+
+    std::vector<uint16_t> pid;
+    std::vector<uint8_t> flags;
+    std::vector<uint8_t> scramblingControl;
+    std::vector<uint8_t> adaptationFieldControl;
+    std::vector<uint8_t> continuityCounter;
+
+private:
+    void decodeScalar(const uint8_t *p, size_t first, size_t count, unsigned int stride);
+
+    size_t m_count;
+};
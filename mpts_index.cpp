@@ -0,0 +1,285 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sys/stat.h>
+#include "mpts_index.h"
+#include "mpts_parallel.h"
+#include "util.h"
+
+bool mptsIndex::identifyFile(const char *fileName, uint64_t &fileSize, uint64_t &modified, uint32_t &headCrc)
+{
+    struct stat status;
+
+    if(0 != stat(fileName, &status))
+        return false;
+
+    FILE *pFile = fopen(fileName, "rb");
+
+    if(nullptr == pFile)
+        return false;
+
+    std::unique_ptr<uint8_t[]> head(new uint8_t[MPTS_INDEX_HEAD_SIZE]);
+    size_t headSize = fread(head.get(), 1, MPTS_INDEX_HEAD_SIZE, pFile);
+
+    fclose(pFile);
+
+    fileSize = (uint64_t) status.st_size;
+    modified = (uint64_t) status.st_mtime;
+    headCrc = util::crc32(head.get(), headSize);
+
+    return true;
+}
+
+void mptsIndexWriter::begin(const char *fileName, int64_t fileSize, unsigned int packetSize)
+{
+    uint8_t header[MPTS_INDEX_HEADER_SIZE] = { 0 };
+    uint64_t size = 0, modified = 0;
+    uint32_t headCrc = 0;
+
+    mptsIndex::identifyFile(fileName, size, modified, headCrc);
+
+    // The size the parse saw, an index of a file that grew in the meantime won't match on load
+    memcpy(header, MPTS_INDEX_MAGIC, 8);
+    util::writeLittleEndian(header + 8, (uint64_t) fileSize, 8);
+    util::writeLittleEndian(header + 16, modified, 8);
+    util::writeLittleEndian(header + 24, headCrc, 4);
+    util::writeLittleEndian(header + 28, packetSize, 4);
+    util::writeLittleEndian(header + 32, MPTS_INDEX_ENTRY_SIZE, 4);
+
+    util::writeOutput(header, sizeof(header));
+}
+
+void mptsIndexWriter::write(const mptsRecord &record)
+{
+    if(eRecordFrame != record.type)
+        return;
+
+    uint8_t p[MPTS_INDEX_ENTRY_SIZE];
+
+    util::writeLittleEndian(p, record.number, 8);
+    util::writeLittleEndian(p + 8, (uint64_t) record.position, 8);
+    util::writeLittleEndian(p + 16, record.pts, 8);
+    util::writeLittleEndian(p + 24, record.dts, 8);
+    util::writeLittleEndian(p + 32, record.value, 4);
+    util::writeLittleEndian(p + 36, record.pid, 2);
+    p[38] = record.flags & ~eRecordGopStart;
+    p[39] = (record.flags & eRecordGopStart) ? 1 : 0;
+
+    util::writeOutput(p, sizeof(p));
+}
+
+// Index entries have no packet numbers, only the frame numbers move on
+void mptsIndexWriter::copy(FILE *pInput, uint64_t, uint64_t frameOffset)
+{
+    uint8_t buffer[MPTS_INDEX_ENTRY_SIZE * 1024];
+    size_t count;
+
+    rewind(pInput);
+
+    while((count = fread(buffer, MPTS_INDEX_ENTRY_SIZE, 1024, pInput)) > 0)
+    {
+        for(uint8_t *p = buffer; frameOffset && p < buffer + count * MPTS_INDEX_ENTRY_SIZE; p += MPTS_INDEX_ENTRY_SIZE)
+            util::writeLittleEndian(p, util::readLittleEndian(p, 8) + frameOffset, 8);
+
+        util::writeOutput(buffer, count * MPTS_INDEX_ENTRY_SIZE);
+    }
+}
+
+mptsIndex::mptsIndex()
+{
+}
+
+std::string mptsIndex::getIndexName(const char *fileName)
+{
+    return std::string(fileName) + ".idx";
+}
+
+bool mptsIndex::load(const char *fileName)
+{
+    uint64_t fileSize = 0, modified = 0;
+    uint32_t headCrc = 0;
+
+    m_entries.clear();
+    m_name = getIndexName(fileName);
+
+    if(false == identifyFile(fileName, fileSize, modified, headCrc))
+        return false;
+
+    FILE *pFile = fopen(m_name.c_str(), "rb");
+
+    if(nullptr == pFile)
+        return false;
+
+    uint8_t header[MPTS_INDEX_HEADER_SIZE];
+    bool bValid = (1 == fread(header, sizeof(header), 1, pFile)) &&
+                  0 == memcmp(header, MPTS_INDEX_MAGIC, 8) &&
+                  fileSize == util::readLittleEndian(header + 8, 8) &&
+                  modified == util::readLittleEndian(header + 16, 8) &&
+                  headCrc == util::readLittleEndian(header + 24, 4) &&
+                  MPTS_INDEX_ENTRY_SIZE == util::readLittleEndian(header + 32, 4);
+
+    uint8_t buffer[MPTS_INDEX_ENTRY_SIZE * 1024];
+    size_t count;
+
+    while(bValid && (count = fread(buffer, MPTS_INDEX_ENTRY_SIZE, 1024, pFile)) > 0)
+    {
+        for(const uint8_t *p = buffer; p < buffer + count * MPTS_INDEX_ENTRY_SIZE; p += MPTS_INDEX_ENTRY_SIZE)
+        {
+            mptsIndexEntry entry;
+
+            entry.number = util::readLittleEndian(p, 8);
+            entry.position = (int64_t) util::readLittleEndian(p + 8, 8);
+            entry.pts = util::readLittleEndian(p + 16, 8);
+            entry.dts = util::readLittleEndian(p + 24, 8);
+            entry.packets = (uint32_t) util::readLittleEndian(p + 32, 4);
+            entry.pid = (uint16_t) util::readLittleEndian(p + 36, 2);
+            entry.type = (char) p[38];
+            entry.bGopStart = 0 != p[39];
+
+            m_entries.push_back(entry);
+        }
+    }
+
+    fclose(pFile);
+
+    if(false == bValid)
+        m_entries.clear();
+
+    return bValid;
+}
+
+bool mptsIndex::build(const char *fileName, int64_t fileSize, unsigned int packetSize, size_t blockSize, unsigned int jobs, bool bMemoryMap, bool bProgress)
+{
+    std::string indexName = getIndexName(fileName);
+    std::string tempName = indexName + ".tmp";
+    FILE *pFile = fopen(tempName.c_str(), "wb");
+
+    if(nullptr == pFile)
+        return false;
+
+    // Only the index entries are written while the index is built
+    FILE *pXmlFile = util::getXmlFile();
+    asyncWriter *pWriter = util::getXmlWriter();
+    bool bXmlOut = util::g_bXmlOut;
+
+    util::setXmlOutput(false);
+    util::setXmlFile(pFile);
+
+    mptsIndexWriter writer;
+    writer.begin(fileName, fileSize, packetSize);
+
+    mptsParallel parallel(fileName, fileSize, packetSize, blockSize);
+    parallel.setAnalyzeElementaryStream(true);
+    parallel.setMemoryMap(bMemoryMap);
+    parallel.setProgress(bProgress);
+    parallel.setRecordWriter(&writer);
+
+    bool bOk = parallel.run(jobs);
+
+    util::setXmlFile(nullptr);
+    util::setXmlOutput(bXmlOut);
+
+    if(pWriter)
+        util::setXmlWriter(pWriter);
+    else
+        util::setXmlFile(pXmlFile);
+
+    if(0 != fclose(pFile))
+        bOk = false;
+
+    // Replace the old index only with a complete one
+    if(bOk)
+    {
+        remove(indexName.c_str());
+        bOk = (0 == rename(tempName.c_str(), indexName.c_str()));
+    }
+
+    if(false == bOk)
+    {
+        remove(tempName.c_str());
+        return false;
+    }
+
+    return load(fileName);
+}
+
+const mptsIndexEntry *mptsIndex::findFrame(uint64_t number) const
+{
+    // Frames are numbered from 0 without gaps
+    if(number < m_entries.size() && number == m_entries[number].number)
+        return &m_entries[number];
+
+    return nullptr;
+}
+
+// Frames are in decode order, so the PTS go back and forth and every frame is looked at
+const mptsIndexEntry *mptsIndex::findPts(uint64_t pts, int pid) const
+{
+    const mptsIndexEntry *pBest = nullptr;
+
+    if(-1 == pid && false == m_entries.empty())
+        pid = m_entries[0].pid;
+
+    for(const mptsIndexEntry &entry : m_entries)
+    {
+        if(pid == entry.pid && entry.pts <= pts && (nullptr == pBest || entry.pts > pBest->pts))
+            pBest = &entry;
+    }
+
+    return pBest;
+}
+
+void mptsIndex::printSummary() const
+{
+    uint64_t gops = 0, iFrames = 0, pFrames = 0, bFrames = 0;
+    uint64_t firstPts = 0, lastPts = 0;
+
+    for(const mptsIndexEntry &entry : m_entries)
+    {
+        gops += entry.bGopStart ? 1 : 0;
+        iFrames += ('I' == entry.type) ? 1 : 0;
+        pFrames += ('P' == entry.type) ? 1 : 0;
+        bFrames += ('B' == entry.type) ? 1 : 0;
+
+        if(&entry == &m_entries.front() || entry.pts < firstPts)
+            firstPts = entry.pts;
+
+        if(entry.pts > lastPts)
+            lastPts = entry.pts;
+    }
+
+    util::printfXml(1, "<index name=\"%s\" frames=\"%zu\" gops=\"%llu\" i=\"%llu\" p=\"%llu\" b=\"%llu\" first_pts=\"%llu\" last_pts=\"%llu\" seconds=\"%f\"/>\n",
+        m_name.c_str(), m_entries.size(), gops, iFrames, pFrames, bFrames, firstPts, lastPts, (double) (lastPts - firstPts) / 90000.);
+}
+
+void mptsIndex::printFrame(const mptsIndexEntry &entry) const
+{
+    util::printfXml(1, "<frame number=\"%llu\" pid=\"0x%x\" byte=\"%lld\" packets=\"%u\" type=\"%c\" gop_start=\"%d\" PTS=\"%llu\" DTS=\"%llu\"/>\n",
+        entry.number, entry.pid, entry.position, entry.packets, entry.type ? entry.type : '?', entry.bGopStart ? 1 : 0, entry.pts, entry.dts);
+}
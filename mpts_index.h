@@ -0,0 +1,106 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "mpts_records.h"
+
+// Frame index, kept next to the input as <input>.idx, so later runs can find a frame without parsing the file again.
+//
+//   header   8 bytes   MPTS_INDEX_MAGIC
+//            8 bytes   size of the input
+//            8 bytes   modification time of the input, in seconds
+//            4 bytes   CRC_32 of the first MPTS_INDEX_HEAD_SIZE bytes of the input
+//            4 bytes   packet stride of the input, 188, 192 or 204
+//            4 bytes   MPTS_INDEX_ENTRY_SIZE
+//            4 bytes   0
+//   entries  one per frame in frame number order, fields in the order of mptsIndexEntry,
+//            with type and bGopStart a byte each
+//
+// Everything is little endian. An index whose size, time or CRC_32 no longer match the input is built again.
+
+#define MPTS_INDEX_MAGIC "MPTSIDX1"
+#define MPTS_INDEX_HEADER_SIZE 40
+#define MPTS_INDEX_ENTRY_SIZE 40
+#define MPTS_INDEX_HEAD_SIZE (1024 * 1024)
+
+struct mptsIndexEntry
+{
+    uint64_t number;
+    int64_t position;   // File offset of the first packet of the frame
+    uint64_t pts;
+    uint64_t dts;
+    uint32_t packets;
+    uint16_t pid;
+    char type;          // 'I', 'P', 'B' or 0 when it isn't known
+    bool bGopStart;     // A group of pictures header or an IDR picture
+};
+
+// Writes the frame records of a parse as index entries, begin() writes the header
+class mptsIndexWriter : public mptsRecordWriter
+{
+public:
+    void begin(const char *fileName, int64_t fileSize, unsigned int packetSize) override;
+    void write(const mptsRecord &record) override;
+    void copy(FILE *pInput, uint64_t packetOffset, uint64_t frameOffset) override;
+};
+
+class mptsIndex
+{
+public:
+    mptsIndex();
+
+    static std::string getIndexName(const char *fileName);
+
+    // What an index, or a checkpoint, has to match to still be of fileName: its size, modification time
+    // and the CRC_32 of its first MPTS_INDEX_HEAD_SIZE bytes. False when the file can't be read.
+    static bool identifyFile(const char *fileName, uint64_t &fileSize, uint64_t &modified, uint32_t &headCrc);
+
+    // Load the index of fileName, false when there is none or it is out of date
+    bool load(const char *fileName);
+
+    // Parse fileName on jobs threads, write its index and load it
+    bool build(const char *fileName, int64_t fileSize, unsigned int packetSize, size_t blockSize, unsigned int jobs, bool bMemoryMap, bool bProgress);
+
+    size_t getFrameCount() const { return m_entries.size(); }
+
+    // nullptr when there is no such frame
+    const mptsIndexEntry *findFrame(uint64_t number) const;
+
+    // The frame of pid with the latest PTS at or before pts, of the PID of the first frame when pid is -1.
+    // PTS only compare within a PID, each video PID has a clock of its own.
+    const mptsIndexEntry *findPts(uint64_t pts, int pid = -1) const;
+
+    void printSummary() const;
+    void printFrame(const mptsIndexEntry &entry) const;
+
+private:
+    std::string m_name;
+    std::vector<mptsIndexEntry> m_entries;
+};
@@ -0,0 +1,884 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include "mpts_parallel.h"
+#include "mpts_seek.h"
+#include "mpts_checkpoint.h"
+#include "mpts_index.h"
+#include "mpts_writer.h"
+#include "util.h"
+
+mptsParallel::mptsParallel(const char *fileName, int64_t fileSize, unsigned int packetStride, size_t blockSize)
+    : m_fileName(fileName)
+    , m_fileSize(fileSize)
+    , m_packetStride(packetStride)
+    , m_blockSize(blockSize)
+    , m_bTerse(true)
+    , m_bAnalyzeElementaryStream(false)
+    , m_bMemoryMap(false)
+    , m_bProgress(false)
+    , m_bCheckContinuity(false)
+    , m_bAnalyzePcr(false)
+    , m_bStatsOnly(false)
+    , m_bSkipRepeatedTables(false)
+    , m_pRecords(nullptr)
+    , m_rangeStart(0)
+    , m_rangeEnd(fileSize)
+    , m_startTime(-1.)
+    , m_endTime(-1.)
+    , m_checkpointName(nullptr)
+    , m_checkpointSeconds(CHECKPOINT_INTERVAL)
+    , m_fileModified(0)
+    , m_fileHeadCrc(0)
+    , m_resumePosition(-1)
+    , m_pOutput(nullptr)
+    , m_pWriter(nullptr)
+    , m_psiFilePosition(0)
+    , m_boundaryPids(0x2000, false)
+    , m_bAnyBoundary(false)
+    , m_nextChunk(0)
+    , m_bytesParsed(0)
+    , m_packetCount(0)
+    , m_frameCount(0)
+    , m_firstFrameNumber(0)
+    , m_lostBytes(0)
+    , m_resyncCount(0)
+    , m_skippedSections(0)
+    , m_bufferHighWaterMark(0)
+    , m_bufferAllocationCount(0)
+{
+}
+
+mptsParallel::~mptsParallel()
+{
+    for(auto &c : m_chunks)
+    {
+        if(c.pOutput && m_pOutput != c.pOutput)
+            fclose(c.pOutput);
+    }
+}
+
+// Turn the start and end times into file positions, and line everything up on packets
+bool mptsParallel::findRange()
+{
+    if(m_startTime >= 0. || m_endTime >= 0.)
+    {
+        // The video PIDs come from the tables at the start of the file
+        prescan(0);
+
+        std::unique_ptr<mptsReader> pReader = openReader();
+
+        if(nullptr == pReader)
+            return false;
+
+        std::vector<bool> noPids;
+        mptsSeek seek(*pReader, m_fileSize, m_packetStride, m_bAnyBoundary ? m_boundaryPids : noPids);
+
+        if(m_startTime >= 0.)
+            m_rangeStart = seek.findTime(m_startTime, false);
+
+        if(m_endTime >= 0.)
+            m_rangeEnd = seek.findTime(m_endTime, true);
+
+        if(-1 == m_rangeStart || -1 == m_rangeEnd)
+        {
+            fprintf(stderr, "No time stamps found to seek with\n");
+            return false;
+        }
+    }
+
+    m_rangeStart = (m_rangeStart / m_packetStride) * m_packetStride;
+
+    if(m_rangeEnd > m_fileSize)
+        m_rangeEnd = m_fileSize;
+
+    if(m_rangeStart >= m_rangeEnd)
+    {
+        fprintf(stderr, "The range to parse is empty\n");
+        return false;
+    }
+
+    // A resumed run printed it the first time round
+    if((0 != m_rangeStart || m_fileSize != m_rangeEnd) && m_resumePosition < 0)
+        util::printfXml(1, "<range start=\"%lld\" end=\"%lld\"/>\n", m_rangeStart, m_rangeEnd);
+
+    return true;
+}
+
+// Every thread gets a reader of its own
+std::unique_ptr<mptsReader> mptsParallel::openReader()
+{
+    std::unique_ptr<mptsReader> pReader;
+
+    if(m_bMemoryMap)
+    {
+        pReader.reset(new mmapReader);
+
+        if(false == pReader->open(m_fileName))
+            pReader.reset();
+    }
+
+    if(nullptr == pReader)
+    {
+        pReader.reset(new freadReader);
+
+        if(false == pReader->open(m_fileName))
+            return nullptr;
+    }
+
+    pReader->setBlockSize(m_blockSize);
+
+    return pReader;
+}
+
+// Run from to end through a fresh PSI parser, without output.
+// With bStopAtTables it stops as soon as a PMT has been read.
+void mptsParallel::readPsi(int64_t from, int64_t end, bool bStopAtTables)
+{
+    m_pPsi.reset(new mptsParser(m_psiFilePosition));
+    m_pPsi->setSkipRepeatedTables(m_bSkipRepeatedTables);
+
+    std::unique_ptr<mptsReader> pReader = openReader();
+
+    if(nullptr == pReader || false == pReader->seek(from))
+        return;
+
+    FILE *pXmlFile = util::getXmlFile();
+    asyncWriter *pWriter = util::getXmlWriter();
+    util::setXmlFile(nullptr);
+
+    mptsSync sync(m_packetStride, from);
+    unsigned int syncOffset = sync.getSyncOffset();
+    uint8_t *block, *packet;
+    size_t runCount = 0;
+    int64_t runOffset = 0;
+    bool bDone = false;
+
+    while(false == bDone)
+    {
+        size_t blockSize = pReader->read(block);
+
+        if(0 == blockSize)
+            break;
+
+        sync.setBlock(block, blockSize);
+
+        while(false == bDone && sync.nextRun(packet, runCount, runOffset))
+        {
+            for(size_t i = 0; i < runCount; i++, packet += m_packetStride)
+            {
+                m_psiFilePosition = runOffset + i * m_packetStride;
+
+                if(m_psiFilePosition >= end)
+                {
+                    bDone = true;
+                    break;
+                }
+
+                m_pPsi->processPacket(packet + syncOffset, m_psiFilePosition / m_packetStride);
+
+                if(bStopAtTables && m_pPsi->hasProgramInfo())
+                {
+                    bDone = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    if(pWriter)
+        util::setXmlWriter(pWriter);
+    else
+        util::setXmlFile(pXmlFile);
+}
+
+// Get the program tables in force at position, from the nearest PAT and PMT before it.
+// When there are none before it use the first ones after it.
+void mptsParallel::prescan(int64_t position)
+{
+    for(int64_t window = PARALLEL_PSI_WINDOW; position > 0; window *= 4)
+    {
+        int64_t from = (position > window) ? ((position - window) / m_packetStride) * m_packetStride : 0;
+
+        readPsi(from, position, false);
+
+        if(m_pPsi->hasProgramInfo() || 0 == from)
+            break;
+    }
+
+    if(0 == position || false == m_pPsi->hasProgramInfo())
+        readPsi(position, position + PARALLEL_PRESCAN_LIMIT, true);
+
+    m_boundaryPids.assign(0x2000, false);
+    m_bAnyBoundary = false;
+
+    for(uint16_t pid = 0; pid < 0x2000; pid++)
+    {
+        if(m_pPsi->isVideoPid(pid))
+        {
+            m_boundaryPids[pid] = true;
+            m_bAnyBoundary = true;
+        }
+    }
+}
+
+// A chunk may begin at any packet that starts a video PES packet.
+// Without any video every packet will do.
+bool mptsParallel::isBoundary(const uint8_t *packet)
+{
+    if(false == m_bAnyBoundary)
+        return true;
+
+    uint16_t pid = util::read2Bytes((uint8_t *) packet + 1);
+    bool payloadUnitStart = 0 != (pid & 0x4000);
+
+    return payloadUnitStart && m_boundaryPids[pid & 0x1FFF];
+}
+
+void mptsParallel::parseChunk(chunk &c)
+{
+    std::unique_ptr<mptsReader> pReader = openReader();
+
+    // A single chunk needs no stitching, unless it has to be numbered on from a checkpoint or a first frame number
+    c.pOutput = (1 == m_chunks.size() && m_resumePosition < 0 && 0 == m_firstFrameNumber) ? m_pOutput : tmpfile();
+
+    if(nullptr == pReader || nullptr == c.pOutput || false == pReader->seek(c.start))
+    {
+        c.bFailed = true;
+        return;
+    }
+
+    // While a lone chunk writes, the thread that called run() waits, so the writer still has a single producer
+    if(m_pWriter && m_pOutput == c.pOutput)
+        util::setXmlWriter(m_pWriter);
+    else
+        util::setXmlFile(c.pOutput);
+
+    int64_t filePosition = 0;
+    mptsParser mpts(filePosition);
+    mpts.setTerse(m_bTerse);
+    mpts.setAnalyzeElementaryStream(m_bAnalyzeElementaryStream);
+    mpts.setPidFilter(m_pidFilter);
+    mpts.setCheckContinuity(m_bCheckContinuity);
+    mpts.setAnalyzePcr(m_bAnalyzePcr, true);
+    mpts.setStatsOnly(m_bStatsOnly);
+    mpts.setSkipRepeatedTables(m_bSkipRepeatedTables);
+    mpts.setRecordWriter(m_pRecords);
+
+    // The first chunk reads the program tables for itself, just like a sequential parse.
+    // The others leave the frames that began before them to the chunk before.
+    if(c.start)
+    {
+        mpts.copyProgramInfo(*m_pPsi);
+        mpts.setSkipPartialFrames(true);
+    }
+
+    mptsSync sync(m_packetStride, c.start);
+    unsigned int syncOffset = sync.getSyncOffset();
+    uint8_t *block = nullptr, *packet;
+    size_t runCount = 0;
+    int64_t runOffset = 0;
+
+    bool bStarted = (0 == c.start);
+    bool bStopped = false;
+    bool bFinishing = false;    // Past the end, completing the frames of other video PIDs
+
+    // Losses before the first packet of the chunk belong to the chunk before
+    int64_t lostBytesBefore = 0;
+    uint64_t resyncCountBefore = 0;
+    size_t lossesBefore = 0;
+
+    int64_t readOffset = c.start;
+    size_t blockSize = pReader->read(block);
+
+    for(;;)
+    {
+        sync.setBlock(block, blockSize);
+
+        if(pReader->isPinned())
+            mpts.setPinnedBlock(block, blockSize);
+
+        while((false == bStopped || bFinishing) && sync.nextRun(packet, runCount, runOffset))
+        {
+            size_t first = 0;
+            size_t last = runCount;
+
+            if(bStopped)
+            {
+                filePosition = runOffset;
+                bFinishing = mpts.finishFrames(packet, runCount, m_packetStride);
+                continue;
+            }
+
+            // Skip to the packet the chunk begins at
+            if(false == bStarted)
+            {
+                while(first < runCount && false == isBoundary(packet + first * m_packetStride + syncOffset))
+                    first++;
+
+                if(first == runCount)
+                    continue;
+
+                bStarted = true;
+                lostBytesBefore = sync.getLostBytes();
+                resyncCountBefore = sync.getResyncCount();
+                lossesBefore = sync.getLosses().size();
+            }
+
+            // Only a boundary at or after the end of the chunk stops it
+            size_t endIndex = (c.end > runOffset) ? (size_t) ((c.end - runOffset + m_packetStride - 1) / m_packetStride) : 0;
+
+            for(size_t i = (endIndex > first) ? endIndex : first; i < runCount; i++)
+            {
+                if(isBoundary(packet + i * m_packetStride + syncOffset))
+                {
+                    last = i;
+                    bStopped = true;
+                    break;
+                }
+            }
+
+            if(last > first)
+            {
+                filePosition = runOffset + first * m_packetStride;
+
+                if(0 != mpts.processPackets(packet + first * m_packetStride, last - first, m_packetStride, c.packetCount))
+                {
+                    c.bFailed = true;
+                    bStopped = true;
+                }
+
+                c.packetCount += last - first;
+            }
+
+            if(bStopped && false == c.bFailed)
+            {
+                filePosition = runOffset + last * m_packetStride;
+                bFinishing = mpts.finishFrames(packet + last * m_packetStride, runCount - last, m_packetStride);
+            }
+        }
+
+        // Progress only counts the chunk's own bytes, not the run on into the next one
+        if(readOffset < c.end)
+            m_bytesParsed += (c.end - readOffset < (int64_t) blockSize) ? c.end - readOffset : blockSize;
+
+        readOffset += blockSize;
+
+        if((bStopped && false == bFinishing) || 0 == blockSize)
+            break;
+
+        blockSize = pReader->read(block);
+    }
+
+    // Only the chunk that reached the end of the file owns what is left unsynchronized
+    if(false == bStopped)
+        sync.finish();
+
+    mpts.flush();
+
+    util::setXmlFile(nullptr);
+    fflush(c.pOutput);
+
+    c.frameCount = mpts.getFrameCount();
+    c.skippedSections = mpts.getSkippedSectionCount();
+    c.bufferHighWaterMark = mpts.getBufferPool().getHighWaterMark();
+    c.bufferAllocationCount = mpts.getBufferPool().getAllocationCount();
+
+    if(mpts.getContinuity())
+        c.pContinuity.reset(new mptsContinuity(*mpts.getContinuity()));
+
+    if(mpts.getPcr())
+        c.pPcr.reset(new mptsPcr(*mpts.getPcr()));
+
+    if(mpts.getStats())
+        c.pStats.reset(new mptsStats(*mpts.getStats()));
+
+    if(mpts.getTables())
+        c.pTables.reset(new mptsTableCache(*mpts.getTables()));
+
+    if(bStarted)
+    {
+        c.lostBytes = sync.getLostBytes() - lostBytesBefore;
+        c.resyncCount = sync.getResyncCount() - resyncCountBefore;
+        c.losses.assign(sync.getLosses().begin() + lossesBefore, sync.getLosses().end());
+    }
+}
+
+void mptsParallel::workerThread()
+{
+    for(;;)
+    {
+        size_t index = m_nextChunk++;
+
+        if(index >= m_chunks.size())
+            return;
+
+        parseChunk(m_chunks[index]);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_chunks[index].bDone = true;
+        }
+
+        m_doneCondition.notify_all();
+    }
+}
+
+// Copy the chunk's xml to the output, numbering its packets and frames on from the chunks before it
+void mptsParallel::copyOutput(chunk &c)
+{
+    static const char frameTag[] = "<frame number=\"";
+    static const char packetTag[] = "<packet start=\"";
+    static const char numberTag[] = "<number>";
+    std::string text;
+    bool bPacketNumberNext = false;
+
+    rewind(c.pOutput);
+
+    while(util::readLine(c.pOutput, text))
+    {
+        char *line = &text[0];
+        char *pTag = line;
+        char *pNumber = nullptr;
+        size_t offset = 0;
+
+        while(' ' == *pTag)
+            pTag++;
+
+        // The packet number is always the line after the packet's opening tag
+        if(bPacketNumberNext && 0 == strncmp(pTag, numberTag, sizeof(numberTag) - 1))
+        {
+            pNumber = pTag + sizeof(numberTag) - 1;
+            offset = m_packetCount;
+        }
+        else if(0 == strncmp(pTag, frameTag, sizeof(frameTag) - 1))
+        {
+            pNumber = pTag + sizeof(frameTag) - 1;
+            offset = m_frameCount;
+        }
+
+        bPacketNumberNext = (0 == strncmp(pTag, packetTag, sizeof(packetTag) - 1));
+
+        if(pNumber && offset)
+        {
+            char *pRest = nullptr;
+            unsigned long long number = strtoull(pNumber, &pRest, 10);
+            char digits[24];
+            int length = snprintf(digits, sizeof(digits), "%llu", number + offset);
+
+            util::writeXml(line, pNumber - line);
+            util::writeXml(digits, length);
+            util::writeXml(pRest, text.size() - (pRest - line));
+        }
+        else
+            util::writeXml(line, text.size());
+    }
+
+    fclose(c.pOutput);
+}
+
+void mptsParallel::stitchChunk(chunk &c)
+{
+    // A lone chunk wrote straight to the output
+    if(m_pOutput != c.pOutput)
+    {
+        if(m_pRecords)
+        {
+            m_pRecords->copy(c.pOutput, m_packetCount, m_frameCount);
+            fclose(c.pOutput);
+        }
+        else
+            copyOutput(c);
+    }
+
+    c.pOutput = nullptr;
+
+    m_packetCount += c.packetCount;
+    m_frameCount += c.frameCount;
+    m_lostBytes += c.lostBytes;
+    m_resyncCount += c.resyncCount;
+    m_skippedSections += c.skippedSections;
+    m_bufferAllocationCount += c.bufferAllocationCount;
+
+    // Each chunk checked its own packets, the counters across the joins are checked here
+    if(c.pContinuity)
+    {
+        if(m_pContinuity)
+            m_pContinuity->append(*c.pContinuity);
+        else
+            m_pContinuity = std::move(c.pContinuity);
+
+        c.pContinuity.reset();
+    }
+
+    // Every chunk holds back its first PCRs, even the first one is run on from an empty start
+    if(c.pPcr)
+    {
+        if(nullptr == m_pPcr)
+            m_pPcr.reset(new mptsPcr);
+
+        m_pPcr->append(*c.pPcr);
+        c.pPcr.reset();
+    }
+
+    if(c.pStats)
+    {
+        if(m_pStats)
+            m_pStats->append(*c.pStats);
+        else
+            m_pStats = std::move(c.pStats);
+
+        c.pStats.reset();
+    }
+
+    if(c.pTables)
+    {
+        if(m_pTables)
+            m_pTables->append(*c.pTables);
+        else
+            m_pTables = std::move(c.pTables);
+
+        c.pTables.reset();
+    }
+
+    if(c.bufferHighWaterMark > m_bufferHighWaterMark)
+        m_bufferHighWaterMark = c.bufferHighWaterMark;
+
+    for(const auto &loss : c.losses)
+    {
+        if(m_losses.size() < SYNC_MAX_RECORDED_LOSSES)
+            m_losses.push_back(loss);
+    }
+}
+
+void mptsParallel::setCheckpoint(const char *fileName, double intervalSeconds, const std::string &options)
+{
+    m_checkpointName = fileName;
+    m_checkpointSeconds = intervalSeconds;
+    m_checkpointOptions = options;
+
+    uint64_t size = 0;
+
+    mptsIndex::identifyFile(m_fileName, size, m_fileModified, m_fileHeadCrc);
+}
+
+// Everything stitched so far goes to the file first, so the checkpoint can say where the output ends
+bool mptsParallel::saveCheckpoint(int64_t position)
+{
+    util::flushXml();
+
+    if(m_pWriter)
+        m_pWriter->drain();
+
+    // The checkpoint must never point past what reached the disk
+    if(false == mptsCheckpoint::sync(m_pOutput) || (m_pPcr && false == m_pPcr->sync()))
+        return false;
+
+    mptsCheckpoint checkpoint;
+
+    if(false == checkpoint.create(m_checkpointName))
+        return false;
+
+    checkpoint.put(std::string(m_fileName));
+    checkpoint.put((uint64_t) m_fileSize);
+    checkpoint.put(m_fileModified);
+    checkpoint.put(m_fileHeadCrc);
+    checkpoint.put(m_checkpointOptions);
+    checkpoint.put((uint64_t) position);
+    checkpoint.put((uint64_t) mptsCheckpoint::tell(m_pOutput));
+
+    checkpoint.put(m_packetCount);
+    checkpoint.put(m_frameCount);
+    checkpoint.put((uint64_t) m_lostBytes);
+    checkpoint.put(m_resyncCount);
+    checkpoint.put(m_skippedSections);
+    checkpoint.put(m_bufferHighWaterMark);
+    checkpoint.put(m_bufferAllocationCount);
+    checkpoint.put(m_losses.size());
+
+    for(const auto &loss : m_losses)
+    {
+        checkpoint.put((uint64_t) loss.fileOffset);
+        checkpoint.put((uint64_t) loss.bytes);
+    }
+
+    // Only the summaries that were turned on
+    checkpoint.put(nullptr != m_pContinuity);
+
+    if(m_pContinuity)
+        m_pContinuity->save(checkpoint);
+
+    checkpoint.put(nullptr != m_pPcr);
+
+    if(m_pPcr)
+        m_pPcr->save(checkpoint);
+
+    checkpoint.put(nullptr != m_pStats);
+
+    if(m_pStats)
+        m_pStats->save(checkpoint);
+
+    checkpoint.put(nullptr != m_pTables);
+
+    if(m_pTables)
+        m_pTables->save(checkpoint);
+
+    return checkpoint.commit();
+}
+
+bool mptsParallel::resumeCheckpoint(int64_t &outputSize)
+{
+    mptsCheckpoint checkpoint;
+
+    if(nullptr == m_checkpointName || false == checkpoint.open(m_checkpointName))
+        return false;
+
+    if(checkpoint.getString() != m_fileName || (int64_t) checkpoint.get() != m_fileSize || checkpoint.get() != m_fileModified ||
+        checkpoint.get() != m_fileHeadCrc || checkpoint.getString() != m_checkpointOptions)
+        return false;
+
+    m_resumePosition = (int64_t) checkpoint.get();
+    outputSize = (int64_t) checkpoint.get();
+
+    m_packetCount = (size_t) checkpoint.get();
+    m_frameCount = (unsigned int) checkpoint.get();
+    m_lostBytes = (int64_t) checkpoint.get();
+    m_resyncCount = checkpoint.get();
+    m_skippedSections = checkpoint.get();
+    m_bufferHighWaterMark = (size_t) checkpoint.get();
+    m_bufferAllocationCount = (size_t) checkpoint.get();
+
+    uint64_t losses = checkpoint.get();
+
+    for(uint64_t i = 0; i < losses && checkpoint.isGood(); i++)
+    {
+        int64_t fileOffset = (int64_t) checkpoint.get();
+        int64_t bytes = (int64_t) checkpoint.get();
+
+        m_losses.emplace_back(fileOffset, bytes);
+    }
+
+    if(checkpoint.get())
+    {
+        m_pContinuity.reset(new mptsContinuity);
+        m_pContinuity->load(checkpoint);
+    }
+
+    if(checkpoint.get())
+    {
+        m_pPcr.reset(new mptsPcr);
+        m_pPcr->load(checkpoint);
+    }
+
+    if(checkpoint.get())
+    {
+        m_pStats.reset(new mptsStats);
+        m_pStats->load(checkpoint);
+    }
+
+    if(checkpoint.get())
+    {
+        m_pTables.reset(new mptsTableCache);
+        m_pTables->load(checkpoint);
+    }
+
+    std::string windowsName = std::string(m_checkpointName) + CHECKPOINT_PCR_SUFFIX;
+
+    if(checkpoint.isGood() && m_resumePosition > 0 && m_resumePosition < m_fileSize && outputSize >= 0 &&
+        (nullptr == m_pPcr || m_pPcr->keepWindows(windowsName.c_str(), true)))
+        return true;
+
+    m_resumePosition = -1;
+    m_packetCount = 0;
+    m_frameCount = m_firstFrameNumber;
+    m_lostBytes = 0;
+    m_resyncCount = 0;
+    m_skippedSections = 0;
+    m_bufferHighWaterMark = 0;
+    m_bufferAllocationCount = 0;
+    m_losses.clear();
+    m_pContinuity.reset();
+    m_pPcr.reset();
+    m_pStats.reset();
+    m_pTables.reset();
+
+    return false;
+}
+
+void mptsParallel::removeCheckpoint()
+{
+    // Its windows are still open
+    m_pPcr.reset();
+
+    remove(m_checkpointName);
+    remove((std::string(m_checkpointName) + CHECKPOINT_PCR_SUFFIX).c_str());
+}
+
+bool mptsParallel::run(unsigned int jobs)
+{
+    if(0 == jobs)
+        jobs = 1;
+
+    if(false == findRange())
+        return false;
+
+    // The PSI in force at the start of the range, resumed or not
+    prescan(m_rangeStart);
+
+    int64_t rangeSize = m_rangeEnd - m_rangeStart;
+
+    // Split at packet boundaries, no chunk smaller than a read block
+    int64_t chunkCount = (jobs > 1) ? (int64_t) jobs * PARALLEL_CHUNKS_PER_JOB : 1;
+    int64_t minimumChunk = m_blockSize ? m_blockSize : m_packetStride;
+
+    // Often enough a chance for a checkpoint, even on a single thread
+    if(m_checkpointName && chunkCount < (rangeSize + CHECKPOINT_CHUNK_SIZE - 1) / CHECKPOINT_CHUNK_SIZE)
+        chunkCount = (rangeSize + CHECKPOINT_CHUNK_SIZE - 1) / CHECKPOINT_CHUNK_SIZE;
+
+    if(chunkCount > rangeSize / minimumChunk)
+        chunkCount = rangeSize / minimumChunk;
+
+    if(0 == chunkCount)
+        chunkCount = 1;
+
+    int64_t chunkSize = (rangeSize / chunkCount / m_packetStride) * m_packetStride;
+
+    m_chunks.resize(chunkCount);
+
+    for(int64_t i = 0; i < chunkCount; i++)
+    {
+        chunk &c = m_chunks[i];
+
+        c.start = m_rangeStart + i * chunkSize;
+        c.end = (chunkCount - 1 == i) ? m_rangeEnd : c.start + chunkSize;
+        c.pOutput = nullptr;
+        c.packetCount = 0;
+        c.frameCount = 0;
+        c.lostBytes = 0;
+        c.resyncCount = 0;
+        c.skippedSections = 0;
+        c.bufferHighWaterMark = 0;
+        c.bufferAllocationCount = 0;
+        c.bDone = false;
+        c.bFailed = false;
+    }
+
+    // Resumed, the chunks are laid out just like the first time, as the order of the frames of several
+    // video PIDs depends on it, and the ones already in the output are dropped
+    if(m_resumePosition >= 0)
+    {
+        size_t first = 0;
+
+        while(first < m_chunks.size() && m_chunks[first].start != m_resumePosition)
+            first++;
+
+        if(first == m_chunks.size())
+        {
+            fprintf(stderr, "The checkpoint doesn't fall on a chunk of this run\n");
+            return false;
+        }
+
+        m_chunks.erase(m_chunks.begin(), m_chunks.begin() + first);
+        rangeSize = m_rangeEnd - m_resumePosition;
+    }
+
+    if(jobs > m_chunks.size())
+        jobs = (unsigned int) m_chunks.size();
+
+    // The PCR windows go beside the checkpoint, a resumed run already carries on with them
+    if(m_checkpointName && m_bAnalyzePcr && nullptr == m_pPcr)
+    {
+        m_pPcr.reset(new mptsPcr);
+
+        if(false == m_pPcr->keepWindows((std::string(m_checkpointName) + CHECKPOINT_PCR_SUFFIX).c_str(), false))
+        {
+            fprintf(stderr, "Can't create %s%s\n", m_checkpointName, CHECKPOINT_PCR_SUFFIX);
+            return false;
+        }
+    }
+
+    // A lone chunk writes to the same file from its own thread
+    m_pOutput = util::getXmlFile();
+    m_pWriter = util::getXmlWriter();
+    util::flushXml();
+
+    std::vector<std::thread> threads;
+
+    for(unsigned int i = 0; i < jobs; i++)
+        threads.emplace_back(&mptsParallel::workerThread, this);
+
+    bool bOk = true;
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+
+    // Stitch each chunk as soon as it and all the chunks before it are done
+    for(size_t i = 0; i < m_chunks.size(); i++)
+    {
+        chunk &c = m_chunks[i];
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            while(false == c.bDone)
+            {
+                m_doneCondition.wait_for(lock, std::chrono::milliseconds(250));
+
+                if(m_bProgress)
+                    fprintf(stderr, "Total bytes processed: %llu, %2.2f%%\r", (long long unsigned) m_bytesParsed, ((float) m_bytesParsed / (float) rangeSize) * 100.f);
+            }
+        }
+
+        if(c.bFailed)
+        {
+            bOk = false;
+            break;
+        }
+
+        stitchChunk(c);
+
+        std::chrono::duration<double> sinceCheckpoint = std::chrono::steady_clock::now() - lastCheckpoint;
+
+        // The next chunk is where a resumed run starts
+        if(m_checkpointName && i + 1 < m_chunks.size() && sinceCheckpoint.count() >= m_checkpointSeconds)
+        {
+            if(false == saveCheckpoint(m_chunks[i + 1].start))
+                fprintf(stderr, "Can't save the checkpoint %s\n", m_checkpointName);
+
+            lastCheckpoint = std::chrono::steady_clock::now();
+        }
+    }
+
+    // Let any remaining workers run out of chunks
+    m_nextChunk = m_chunks.size();
+
+    for(auto &thread : threads)
+        thread.join();
+
+    return bOk;
+}
@@ -0,0 +1,217 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "mpts_parser.h"
+#include "mpts_reader.h"
+#include "mpts_sync.h"
+
+// How far into the file to look for the PAT and PMT before giving up
+#define PARALLEL_PRESCAN_LIMIT (64 * 1024 * 1024)
+
+// How far back from the start of a range to look for the PAT and PMT at first
+#define PARALLEL_PSI_WINDOW (4 * 1024 * 1024)
+
+// Chunks per thread, more chunks even out the load when some parts of the file are slower to parse
+#define PARALLEL_CHUNKS_PER_JOB 4
+
+// Parses a file, or a range of it, with several independent mptsParsers, one chunk of the range each.
+//
+// The PSI in force at the start of the range is read first and handed to every parser.
+// Every chunk but the first begins at a payload unit start of a video PID, and every
+// chunk runs on until the payload unit start that begins the next one, so no frame is
+// split between two parsers. With several video PIDs a chunk also runs on until the frames
+// still open on the other PIDs are complete, and the next chunk skips their packets, so those
+// frames come out at the end of the chunk instead of among the first frames of the next one.
+// Repeated PAT and PMT sections are skipped from the tables in force at the start of the range,
+// so a table that changes inside it is printed again by each later chunk that sees it first.
+// The xml, or the records, of each chunk go to a temporary file and are copied to the output
+// in file order, with the packet and frame numbers continuing from the chunk before.
+// Once a chunk is in the output the next one depends on nothing but the PSI and the counts
+// and summaries so far, which is all a checkpoint has to keep.
+//
+class mptsParallel
+{
+public:
+    mptsParallel(const char *fileName, int64_t fileSize, unsigned int packetStride, size_t blockSize);
+    ~mptsParallel();
+
+    void setTerse(bool tf) { m_bTerse = tf; }
+    void setAnalyzeElementaryStream(bool tf) { m_bAnalyzeElementaryStream = tf; }
+    void setMemoryMap(bool tf) { m_bMemoryMap = tf; }
+    void setProgress(bool tf) { m_bProgress = tf; }
+    void setPidFilter(const std::vector<uint16_t> &pids) { m_pidFilter = pids; }
+    void setCheckContinuity(bool tf) { m_bCheckContinuity = tf; }
+    void setAnalyzePcr(bool tf) { m_bAnalyzePcr = tf; }
+    void setStatsOnly(bool tf) { m_bStatsOnly = tf; }
+    void setSkipRepeatedTables(bool tf) { m_bSkipRepeatedTables = tf; }
+    void setRecordWriter(mptsRecordWriter *pRecords) { m_pRecords = pRecords; }
+
+    // Only parse from start to end, in bytes or in seconds from the first time stamp.
+    // The range starts at the first video payload unit start after start, and ends
+    // with the frame that is being sent at end. Negative values leave that end open.
+    void setRange(int64_t start, int64_t end) { m_rangeStart = start < 0 ? 0 : start; m_rangeEnd = end < 0 ? m_fileSize : end; }
+    void setTimeRange(double start, double end) { m_startTime = start; m_endTime = end; }
+
+    // Number the frames from number on instead of from 0, so a range that starts at a frame of the index keeps its number
+    void setFirstFrameNumber(unsigned int number) { m_firstFrameNumber = m_frameCount = number; }
+
+    // Save a checkpoint to fileName after a chunk, once intervalSeconds have passed since the last one.
+    // No chunk is bigger than CHECKPOINT_CHUNK_SIZE then. A checkpoint is only resumed by a run of
+    // the same input, down to its modification time and first bytes as with mptsIndex::identifyFile(),
+    // with the same options, which hold whatever else decides the output, the jobs and block size that
+    // lay out the chunks included.
+    void setCheckpoint(const char *fileName, double intervalSeconds, const std::string &options);
+
+    // Carry on from the checkpoint of setCheckpoint(), call before run(). Anything in the output past
+    // outputSize was written after the checkpoint and has to go. Returns false, with nothing resumed,
+    // when the checkpoint is damaged or from another input or other options, it is up to the caller
+    // to give up or to run from the start.
+    bool resumeCheckpoint(int64_t &outputSize);
+
+    // Remove the checkpoint, and the PCR windows kept beside it, once the output is complete.
+    // getPcr() is nullptr after this.
+    void removeCheckpoint();
+
+    // Parse the whole file using jobs threads.
+    // Returns false when a chunk could not be read or parsed.
+    bool run(unsigned int jobs);
+
+    int64_t getLostBytes() { return m_lostBytes; }
+    uint64_t getResyncCount() { return m_resyncCount; }
+    uint64_t getSkippedSectionCount() { return m_skippedSections; }
+    const std::vector<syncLoss> &getLosses() { return m_losses; }
+
+    // Largest video buffer any chunk needed, and buffer allocations over all chunks
+    size_t getBufferHighWaterMark() { return m_bufferHighWaterMark; }
+    size_t getBufferAllocationCount() { return m_bufferAllocationCount; }
+
+    // The continuity of the whole range, nullptr unless setCheckContinuity() was turned on
+    const mptsContinuity *getContinuity() { return m_pContinuity.get(); }
+    const mptsPcr *getPcr() { return m_pPcr.get(); }
+    const mptsStats *getStats() { return m_pStats.get(); }
+    const mptsTableCache *getTables() { return m_pTables.get(); }
+
+private:
+    struct chunk
+    {
+        int64_t start;  // Where the chunk's reader starts
+        int64_t end;    // The chunk ends at the first boundary packet at or after this
+        FILE *pOutput;
+        size_t packetCount;
+        unsigned int frameCount;
+        int64_t lostBytes;
+        uint64_t resyncCount;
+        uint64_t skippedSections;
+        std::vector<syncLoss> losses;
+        size_t bufferHighWaterMark;
+        size_t bufferAllocationCount;
+        std::unique_ptr<mptsContinuity> pContinuity;
+        std::unique_ptr<mptsPcr> pPcr;
+        std::unique_ptr<mptsStats> pStats;
+        std::unique_ptr<mptsTableCache> pTables;
+        bool bDone;
+        bool bFailed;
+    };
+
+    std::unique_ptr<mptsReader> openReader();
+    bool findRange();
+    void readPsi(int64_t from, int64_t end, bool bStopAtTables);
+    void prescan(int64_t position);
+    bool isBoundary(const uint8_t *packet);
+    void parseChunk(chunk &c);
+    void workerThread();
+    void copyOutput(chunk &c);
+    void stitchChunk(chunk &c);
+    bool saveCheckpoint(int64_t position);
+
+    const char *m_fileName;
+    int64_t m_fileSize;
+    unsigned int m_packetStride;
+    size_t m_blockSize;
+
+    bool m_bTerse;
+    bool m_bAnalyzeElementaryStream;
+    bool m_bMemoryMap;
+    bool m_bProgress;
+    std::vector<uint16_t> m_pidFilter;
+    bool m_bCheckContinuity;
+    bool m_bAnalyzePcr;
+    bool m_bStatsOnly;
+    bool m_bSkipRepeatedTables;
+    mptsRecordWriter *m_pRecords;
+
+    int64_t m_rangeStart;
+    int64_t m_rangeEnd;
+    double m_startTime;
+    double m_endTime;
+
+    const char *m_checkpointName;
+    double m_checkpointSeconds;
+    std::string m_checkpointOptions;
+    uint64_t m_fileModified;    // Of the input, when checkpointing
+    uint32_t m_fileHeadCrc;
+    int64_t m_resumePosition;   // Where the first chunk starts when resuming, -1 otherwise
+
+    // Where the xml of the thread that called run() goes, and the thread that writes it, if any
+    FILE *m_pOutput;
+    asyncWriter *m_pWriter;
+
+    // The parser that read the PSI at the start of the file
+    int64_t m_psiFilePosition;
+    std::unique_ptr<mptsParser> m_pPsi;
+
+    // Payload unit starts on these PIDs are where chunks may begin
+    std::vector<bool> m_boundaryPids;
+    bool m_bAnyBoundary;
+
+    std::vector<chunk> m_chunks;
+    std::atomic<size_t> m_nextChunk;
+    std::atomic<int64_t> m_bytesParsed;
+    std::mutex m_mutex;
+    std::condition_variable m_doneCondition;
+
+    size_t m_packetCount;
+    unsigned int m_frameCount;
+    unsigned int m_firstFrameNumber;
+    int64_t m_lostBytes;
+    uint64_t m_resyncCount;
+    uint64_t m_skippedSections;
+    std::vector<syncLoss> m_losses;
+    size_t m_bufferHighWaterMark;
+    size_t m_bufferAllocationCount;
+    std::unique_ptr<mptsContinuity> m_pContinuity;
+    std::unique_ptr<mptsPcr> m_pPcr;
+    std::unique_ptr<mptsStats> m_pStats;
+    std::unique_ptr<mptsTableCache> m_pTables;
+};
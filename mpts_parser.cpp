@@ -35,37 +35,49 @@
 #include <map>
 #include <variant>
 #include <memory>
+#include <algorithm>
 
 #include "mpts_parser.h"
 #include "mpts_descriptors.h"
+#include "mpts_sync.h"
 #include "mpeg2_parser.h"
 #include "avc_parser.h"
 
-#define VIDEO_DATA_MEMORY_INCREMENT (500 * 1024)
-#define SYNC_BYTE 0x47
+// Bytes of the first slice NAL unit handed to the H.264 parser, more than any slice header needs
+#define AVC_SLICE_HEADER_BYTES 1024
+
+// A PMT section holds the 3 header bytes, 9 more up to program_info_length and the CRC_32
+#define PMT_MIN_SECTION_SIZE 16
 
 //#define 36 - 63 n / a n / a ITU - T Rec.H.222.0 | ISO / IEC 13818 - 1 Reserved
 //#define 64 - 255 n / a n / a User Private
 
-mptsParser::mptsParser(size_t &filePosition)
-    : m_pVideoData(NULL)
-    , m_filePosition(filePosition)
-    , m_packetSize(0)
-    , m_programNumber(-1)
-    , m_programMapPid(-1)
+mptsParser::mptsParser(int64_t &filePosition)
+    : m_filePosition(filePosition)
+    , m_packetSize(TS_PACKET_SIZE)
     , m_networkPid(0x0010)
     , m_scte35Pid(-1)
-    , m_videoDataSize(0)
-    , m_videoBufferSize(0)
+    , m_lastPid(-1)
+    , m_videoFrameNumber(0)
+    , m_frameCount(0)
+    , m_skippedSections(0)
+    , m_pids(ePidCount)
+    , m_bProgramInfo(false)
+    , m_bPidFilter(false)
     , m_bTerse(true)
     , m_bAnalyzeElementaryStream(false)
-    , m_parser(nullptr)
+    , m_bSkipPartialFrames(false)
+    , m_pPinnedStart(nullptr)
+    , m_pPinnedEnd(nullptr)
+    , m_pRecords(nullptr)
 {
 }
 
 mptsParser::~mptsParser()
 {
-    popVideoData();
+    // The payloads use the pool, which goes first
+    for(mptsPidInfo &info : m_pids)
+        info.pVideo.reset();
 }
 
 bool mptsParser::setTerse(bool tf)
@@ -98,8 +110,8 @@ void inline mptsParser::incPtr(uint8_t *&p, size_t bytes)
 }
 
 // Table 2-34
-// Initialize a map of ID to string type
-void mptsParser::initStreamTypes(std::map <uint16_t, const char *> &streamMap)
+// Fill in a table of stream type to name, types without a name are left alone
+void mptsParser::initStreamTypes(const char *streamMap[256])
 {
     streamMap[0x0] = "Reserved";	                            
     streamMap[0x1] = "MPEG-1 Video";
@@ -174,102 +186,128 @@ void mptsParser::initStreamTypes(std::map <uint16_t, const char *> &streamMap)
     streamMap[0xea] = "Private ES(VC-1)";
 }
 
-size_t mptsParser::pushVideoData(uint8_t *p, size_t size)
+// nullptr for stream types with no name
+const char *mptsParser::getStreamTypeName(uint8_t streamType)
 {
-    if(m_videoDataSize + size > m_videoBufferSize)
+    // Built once, the first time a PMT is read
+    struct streamTypeNames
     {
-        m_videoBufferSize += VIDEO_DATA_MEMORY_INCREMENT;
-        m_pVideoData = (uint8_t*) realloc((void*) m_pVideoData, m_videoBufferSize);
-    }
+        const char *names[256] = {};
 
-    std::memcpy(m_pVideoData + m_videoDataSize, p, size);
-    m_videoDataSize += size;
+        streamTypeNames() { initStreamTypes(names); }
+    };
 
-    return m_videoDataSize;
+    static const streamTypeNames table;
+
+    return table.names[streamType];
 }
 
-// Returns the amount of bytes left in the video buffer after compacting
-size_t mptsParser::compactVideoData(size_t bytesToCompact)
+size_t mptsParser::pushVideoData(mptsPayload &payload, uint8_t *p, size_t size)
 {
-    size_t bytes_leftover = m_videoDataSize - bytesToCompact;
+    payload.pushCopy(p, size);
 
-    if(bytes_leftover > 0)
-    {
-        std::memcpy(m_pVideoData, m_pVideoData + bytesToCompact, bytes_leftover);
-        m_videoDataSize = bytes_leftover;
-    }
-
-    return bytes_leftover;
+    return payload.size();
 }
 
-size_t mptsParser::getVideoDataSize()
+size_t mptsParser::popVideoData(mptsPayload &payload)
 {
-    return m_videoDataSize;
+    size_t ret = payload.size();
+
+    payload.clear();
+    
+    return ret;
 }
 
-size_t mptsParser::popVideoData()
+// The frame and payload of a video PID, made the first time it is needed
+mptsVideoStream &mptsParser::getVideoStream(uint16_t pid)
 {
-    size_t ret = m_videoDataSize;
-    if(m_pVideoData)
+    mptsPidInfo &info = m_pids[pid];
+
+    if(nullptr == info.pVideo)
     {
-        free(m_pVideoData);
-        m_pVideoData = NULL;
+        info.pVideo = std::make_shared<mptsVideoStream>(m_bufferPool, pid);
+        info.pVideo->frame.pid = pid;
+        info.pVideo->frame.streamType = info.streamType;
     }
 
-    m_videoDataSize = 0;
-    m_videoBufferSize = 0;
-    
-    return ret;
+    return *info.pVideo;
 }
 
-size_t mptsParser::readPAT(uint8_t*& p, program_association_table& pat, bool payloadUnitStart)
+// A program of the PAT, a new PMT PID replaces the one it had
+mptsProgram &mptsParser::addProgram(uint16_t programNumber, uint16_t pmtPid)
 {
-    uint8_t* p_start = p;
-    pat.payload_start_offset = 0;
-    pat.payload_unit_start = payloadUnitStart;
+    m_pids[pmtPid].bPmt = true;
 
-    if (payloadUnitStart)
+    for(mptsProgram &program : m_programs)
     {
-        pat.payload_start_offset = *p; // Spec 2.4.4.1
-        incPtr(p, 1);
-        incPtr(p, pat.payload_start_offset);
+        if(program.programNumber == programNumber)
+        {
+            program.pmtPid = pmtPid;
+            return program;
+        }
     }
 
-    pat.table_id = *p;
-    incPtr(p, 1);
-    pat.section_length = util::read2Bytes(p);
-    incPtr(p, 2);
-    pat.section_syntax_indicator = (0x8000 & pat.section_length) >> 15;
-    pat.section_length &= 0xFFF;
+    m_programs.emplace_back(programNumber, pmtPid);
 
-    uint8_t* p_section_start = p;
+    return m_programs.back();
+}
 
-    pat.transport_stream_id = util::read2Bytes(p);
-    incPtr(p, 2);
+// The PMT of a program has been read
+void mptsParser::setPcrPid(uint16_t programNumber, uint16_t pcrPid)
+{
+    for(mptsProgram &program : m_programs)
+    {
+        if(program.programNumber == programNumber)
+            program.pcrPid = pcrPid;
+    }
 
-    pat.current_next_indicator = *p;
-    incPtr(p, 1);
-    pat.version_number = (pat.current_next_indicator & 0x3E) >> 1;
-    pat.current_next_indicator &= 0x1;
+    m_pids[pcrPid].pName = "PCR";
 
-    pat.section_number = *p;
-    incPtr(p, 1);
-    pat.last_section_number = *p;
-    incPtr(p, 1);
+    if(m_pPcr)
+        m_pPcr->addPid(pcrPid);
+}
 
-    while ((p - p_section_start) < (pat.section_length - 4))
+// How much of the frame the codec parsers look at: the PES header and everything up to the
+// picture header for MPEG2, or up to the first slice header for H.264.
+// Only that much of the frame has to be in one piece, the rest is never read.
+size_t mptsParser::getFrameHeaderSize(const mptsPayload &payload, eMptsStreamType streamType)
+{
+    size_t size = payload.size();
+    size_t from = 0;
+    uint8_t code = 0;
+    bool bPicture = false;
+
+    if(size < 9 || (eMPEG2_Video != streamType && eH264_Video != streamType))
+        return size;
+
+    // Skip the PES header, its time stamps could look like a start code
+    if(0 == payload.findStartCode(0, code) && code >= system_start_codes_begin)
+        from = 9 + payload.byteAt(8);
+
+    for(size_t offset = payload.findStartCode(from, code); offset < size; offset = payload.findStartCode(offset + 4, code))
     {
-        uint16_t program_number = util::read2Bytes(p);
-        incPtr(p, 2);
+        if(eMPEG2_Video == streamType)
+        {
+            // The picture header ends at the next start code
+            if(bPicture)
+                return offset + 4;
 
-        uint16_t pid = util::read2Bytes(p);
-        pid &= 0x1FFF;
-        incPtr(p, 2);
+            bPicture = (picture_start_code == code);
+        }
+        else
+        {
+            uint8_t nal_unit_type = code & 0x1F;
 
-        pat.program_numbers.emplace_back(program_number, pid);
+            if(eAVCNaluType_CodedSliceNonIdrPicture == nal_unit_type ||
+               eAVCNaluType_CodedSliceIdrPicture == nal_unit_type ||
+               eAVCNaluType_CodedSliceAuxiliaryPicture == nal_unit_type)
+            {
+                return (offset + AVC_SLICE_HEADER_BYTES < size) ? offset + AVC_SLICE_HEADER_BYTES : size;
+            }
+        }
     }
 
-    return p - p_start;
+    return size;
 }
 
 // 2.4.4.3 Program association Table
@@ -277,85 +315,47 @@ size_t mptsParser::readPAT(uint8_t*& p, program_association_table& pat, bool pay
 // The Program Association Table provides the correspondence between a program_number and the PID value of the
 // Transport Stream packets which carry the program definition.The program_number is the numeric label associated with
 // a program.
-size_t mptsParser::readPAT(uint8_t *&p, bool payloadUnitStart)
+size_t mptsParser::readPAT(const mptsSection& section, program_association_table& pat)
 {
+    uint8_t* p = const_cast<uint8_t*>(section.pData);
     uint8_t* p_start = p;
-    uint8_t payload_start_offset = 0;
+    pat.payload_start_offset = section.pointerField; // Spec 2.4.4.1
+    pat.payload_unit_start = section.bPointerField;
 
-    if(payloadUnitStart)
-    {
-        payload_start_offset = *p; // Spec 2.4.4.1
-        incPtr(p, 1);
-        incPtr(p, payload_start_offset);
-    }
-
-    uint8_t table_id = *p;
+    pat.table_id = *p;
     incPtr(p, 1);
-    uint16_t section_length = util::read2Bytes(p);
+    pat.section_length = util::read2Bytes(p);
     incPtr(p, 2);
-    uint8_t section_syntax_indicator = (0x8000 & section_length) >> 15;
-    section_length &= 0xFFF;
+    pat.section_syntax_indicator = (0x8000 & pat.section_length) >> 15;
+    pat.section_length &= 0xFFF;
 
-    uint8_t *p_section_start = p;
+    uint8_t* p_section_start = p;
 
-    uint16_t transport_stream_id = util::read2Bytes(p);
+    pat.transport_stream_id = util::read2Bytes(p);
     incPtr(p, 2);
 
-    uint8_t current_next_indicator = *p;
+    pat.current_next_indicator = *p;
     incPtr(p, 1);
-    uint8_t version_number = (current_next_indicator & 0x3E) >> 1;
-    current_next_indicator &= 0x1;
+    pat.version_number = (pat.current_next_indicator & 0x3E) >> 1;
+    pat.current_next_indicator &= 0x1;
 
-    uint8_t section_number = *p;
+    pat.section_number = *p;
     incPtr(p, 1);
-    uint8_t last_section_number = *p;
+    pat.last_section_number = *p;
     incPtr(p, 1);
 
-    printfXml(2, "<program_association_table>\n");
-    if(payloadUnitStart)
-        printfXml(3, "<pointer_field>0x%x</pointer_field>\n", payload_start_offset);
-    printfXml(3, "<table_id>0x%x</table_id>\n", table_id);
-    printfXml(3, "<section_syntax_indicator>%d</section_syntax_indicator>\n", section_syntax_indicator);
-    printfXml(3, "<section_length>%d</section_length>\n", section_length);
-    printfXml(3, "<transport_stream_id>0x%x</transport_stream_id>\n", transport_stream_id);
-    printfXml(3, "<version_number>0x%x</version_number>\n", version_number);
-    printfXml(3, "<current_next_indicator>0x%x</current_next_indicator>\n", current_next_indicator);
-    printfXml(3, "<section_number>0x%x</section_number>\n", section_number);
-    printfXml(3, "<last_section_number>0x%x</last_section_number>\n", last_section_number);
-
-    while ((p - p_section_start) < (section_length - 4))
+    while ((p - p_section_start) < (pat.section_length - 4))
     {
-        m_programNumber = util::read2Bytes(p);
+        uint16_t program_number = util::read2Bytes(p);
         incPtr(p, 2);
-        uint16_t network_pid = 0;
-
-        if (0 == m_programNumber)
-        {
-            network_pid = util::read2Bytes(p);
-            incPtr(p, 2);
-            network_pid &= 0x1FFF;
-            m_networkPid = network_pid;
-        }
-        else
-        {
-            m_programMapPid = util::read2Bytes(p);
-            incPtr(p, 2);
-            m_programMapPid &= 0x1FFF;
-        }
 
-        printfXml(3, "<program>\n");
-        printfXml(4, "<number>%d</number>\n", m_programNumber);
-
-        if(network_pid)
-            printfXml(4, "<network_pid>0x%x</network_pid>\n", m_networkPid);
-        else
-            printfXml(4, "<program_map_pid>0x%x</program_map_pid>\n", m_programMapPid);
+        uint16_t pid = util::read2Bytes(p);
+        pid &= 0x1FFF;
+        incPtr(p, 2);
 
-        printfXml(3, "</program>\n");
+        pat.program_numbers.emplace_back(program_number, pid);
     }
 
-    printfXml(2, "</program_association_table>\n");
-
     return p - p_start;
 }
 
@@ -364,19 +364,14 @@ size_t mptsParser::readPAT(uint8_t *&p, bool payloadUnitStart)
 // The Program Map Table provides the mappings between program numbers and the program elements that comprise
 // them. A single instance of such a mapping is referred to as a "program definition". The program map table is the
 // complete collection of all program definitions for a Transport Stream.
-size_t mptsParser::readPMT(uint8_t*& p, program_map_table& pmt, bool payloadUnitStart)
+// The section must hold at least PMT_MIN_SECTION_SIZE bytes.
+size_t mptsParser::readPMT(const mptsSection& section, program_map_table& pmt)
 {
+    uint8_t* p = const_cast<uint8_t*>(section.pData);
     uint8_t* p_start = p;
 
-    pmt.payload_start_offset = 0;
-    pmt.payload_unit_start = payloadUnitStart;
-
-    if (payloadUnitStart)
-    {
-        pmt.payload_start_offset = *p; // Spec 2.4.4.1
-        incPtr(p, 1);
-        incPtr(p, pmt.payload_start_offset);
-    }
+    pmt.payload_start_offset = section.pointerField; // Spec 2.4.4.1
+    pmt.payload_unit_start = section.bPointerField;
 
     pmt.table_id = *p;
     incPtr(p, 1);
@@ -409,6 +404,10 @@ size_t mptsParser::readPMT(uint8_t*& p, program_map_table& pmt, bool payloadUnit
 
     pmt.program_info_length &= 0x3FF;
 
+    // Keep the descriptors inside the section
+    if (pmt.program_info_length > section.size - PMT_MIN_SECTION_SIZE)
+        pmt.program_info_length = (uint16_t) (section.size - PMT_MIN_SECTION_SIZE);
+
     p += readElementDescriptors(p, pmt);
 
     // Subtract 4 from section_length to account for 4 byte CRC at its end.  The CRC is not program data.
@@ -432,122 +431,6 @@ size_t mptsParser::readPMT(uint8_t*& p, program_map_table& pmt, bool payloadUnit
     return p - p_start;
 }
 
-// 2.4.4.9 Program Map Table
-//
-// The Program Map Table provides the mappings between program numbers and the program elements that comprise
-// them. A single instance of such a mapping is referred to as a "program definition". The program map table is the
-// complete collection of all program definitions for a Transport Stream.
-size_t mptsParser::readPMT(uint8_t *&p, bool payloadUnitStart)
-{
-    uint8_t* p_start = p;
-    uint8_t payload_start_offset = 0;
-
-    if(payloadUnitStart)
-    {
-        payload_start_offset = *p; // Spec 2.4.4.1
-        incPtr(p, 1);
-        incPtr(p, payload_start_offset);
-    }
-
-    uint8_t table_id = *p;
-    incPtr(p, 1);
-    uint16_t section_length = util::read2Bytes(p);
-    incPtr(p, 2);
-    uint8_t section_syntax_indicator = section_length & 0x80 >> 15;
-    section_length &= 0xFFF;
-
-    uint8_t *p_section_start = p;
-
-    uint16_t program_number = util::read2Bytes(p);
-    incPtr(p, 2);
-
-    uint8_t current_next_indicator = *p;
-    incPtr(p, 1);
-    uint8_t version_number = (current_next_indicator & 0x3E) >> 1;
-    current_next_indicator &= 0x1;
-
-    uint8_t section_number = *p;
-    incPtr(p, 1);
-    uint8_t last_section_number = *p;
-    incPtr(p, 1);
-
-    uint16_t pcr_pid = util::read2Bytes(p);
-    incPtr(p, 2);
-    pcr_pid &= 0x1FFF;
-
-    m_pidToNameMap[pcr_pid] = "PCR";
-
-    uint16_t program_info_length = util::read2Bytes(p);
-    incPtr(p, 2);
-
-    program_info_length &= 0x3FF;
-    
-    printfXml(2, "<program_map_table>\n");
-    if(payloadUnitStart)
-        printfXml(3, "<pointer_field>0x%x</pointer_field>\n", payload_start_offset);
-    printfXml(3, "<table_id>0x%x</table_id>\n", table_id);
-    printfXml(3, "<section_syntax_indicator>%d</section_syntax_indicator>\n", section_syntax_indicator);
-    printfXml(3, "<section_length>%d</section_length>\n", section_length);
-    printfXml(3, "<program_number>%d</program_number>\n", program_number);
-    printfXml(3, "<version_number>%d</version_number>\n", version_number);
-    printfXml(3, "<current_next_indicator>%d</current_next_indicator>\n", current_next_indicator);
-    printfXml(3, "<section_number>%d</section_number>\n", section_number);
-    printfXml(3, "<last_section_number>%d</last_section_number>\n", last_section_number);
-    printfXml(3, "<pcr_pid>0x%x</pcr_pid>\n", pcr_pid);
-    printfXml(3, "<program_info_length>%d</program_info_length>\n", program_info_length);
-
-    p += readElementDescriptors(p, program_info_length);
-
-    //my_printf("program_number:%d, pcr_pid:%x\n", program_number, pcr_pid);
-    //my_printf("  Elementary Streams:\n");
-
-    std::map <uint16_t, const char *> streamMap; // ID, name
-    initStreamTypes(streamMap);
-
-    // This has to be done by hand
-    m_pidToNameMap[0x1FFF] = "NULL Packet";
-
-    size_t stream_count = 0;
-
-    // Subtract 4 from section_length to account for 4 byte CRC at its end.  The CRC is not program data.
-    while((p - p_section_start) < (section_length - 4))
-    {
-        uint8_t stream_type = *p;
-        incPtr(p, 1);
-        uint16_t elementary_pid = util::read2Bytes(p);
-        incPtr(p, 2);
-        elementary_pid &= 0x1FFF;
-
-        uint16_t es_info_length = util::read2Bytes(p);
-        incPtr(p, 2);
-        es_info_length &= 0xFFF;
-
-        p += es_info_length;
-
-        // Scte35 stream type is 0x86
-        if(0x86 == stream_type)
-            m_scte35Pid = elementary_pid;
-
-        m_pidToNameMap[elementary_pid] = streamMap[stream_type];
-        m_pidToTypeMap[elementary_pid] = (eMptsStreamType) stream_type;
-
-        //my_printf("    %d) pid:%x, stream_type:%x (%s)\n", stream_count++, elementary_pid, stream_type, streamMap[stream_type]);
-
-        printfXml(3, "<stream>\n");
-        printfXml(4, "<number>%zd</number>\n", stream_count);
-        printfXml(4, "<pid>0x%x</pid>\n", elementary_pid);
-        printfXml(4, "<type_number>0x%x</type_number>\n", stream_type);
-        printfXml(4, "<type_name>%s</type_name>\n", streamMap[stream_type]);
-        printfXml(3, "</stream>\n");
-
-        stream_count++;
-    }
-
-    printfXml(2, "</program_map_table>\n");
-
-    return p - p_start;
-}
-
 void mptsParser::printElementDescriptors(const program_map_table& pmt)
 {
     unsigned int descriptorNumber = 0;
@@ -2273,13 +2156,18 @@ size_t mptsParser::processPESPacketHeader(uint8_t *&p, size_t PESPacketDataLengt
 }
 
 // Push data into video buffer for later processing by a decoder
-size_t mptsParser::processPESPacket(uint8_t *&packetStart, uint8_t *&p, eMptsStreamType streamType, bool payloadUnitStart)
+size_t mptsParser::processPESPacket(uint8_t *&packetStart, uint8_t *&p, mptsPayload &payload, eMptsStreamType streamType, bool payloadUnitStart)
 {
 #if 1
     size_t PESPacketDataLength = m_packetSize - (p - packetStart);
 
     if (m_bAnalyzeElementaryStream)
-        pushVideoData(p, PESPacketDataLength);
+    {
+        if (p >= m_pPinnedStart && p + PESPacketDataLength <= m_pPinnedEnd)
+            payload.push(p, PESPacketDataLength);
+        else
+            pushVideoData(payload, p, PESPacketDataLength);
+    }
 
     incPtr(p, PESPacketDataLength);
     return PESPacketDataLength;
@@ -2292,7 +2180,7 @@ size_t mptsParser::processPESPacket(uint8_t *&packetStart, uint8_t *&p, eMptsStr
         size_t PESPacketDataLength = m_packetSize - (p - packetStart);
         
         if(m_bAnalyzeElementaryStream)
-            pushVideoData(p, PESPacketDataLength);
+            pushVideoData(payload, p, PESPacketDataLength);
 
         incPtr(p, PESPacketDataLength);
         return PESPacketDataLength;
@@ -2333,7 +2221,7 @@ size_t mptsParser::processPESPacket(uint8_t *&packetStart, uint8_t *&p, eMptsStr
         //{
             // Push first PES packet, lots of info here.
             if(m_bAnalyzeElementaryStream)
-                pushVideoData(p, PESPacketDataLength);
+                pushVideoData(payload, p, PESPacketDataLength);
 
             incPtr(p, PESPacketDataLength);
             //}
@@ -2363,29 +2251,146 @@ size_t mptsParser::processPESPacket(uint8_t *&packetStart, uint8_t *&p, eMptsStr
 #endif
 }
 
-void mptsParser::printFrameInfo(mpts_frame *pFrame)
+void mptsParser::printFrameInfo(mptsVideoStream &video)
 {
-    if(pFrame)
+    mpts_frame *pFrame = &video.frame;
+
+    if(pFrame->pidList.size())
     {
-        if(pFrame->pidList.size())
+        for(mptsPidListType::size_type i = 0; i != pFrame->pidList.size(); i++)
+            pFrame->totalPackets += pFrame->pidList[i].numPackets;
+
+        if(m_bAnalyzeElementaryStream)
         {
-            for(mptsPidListType::size_type i = 0; i != pFrame->pidList.size(); i++)
-                pFrame->totalPackets += pFrame->pidList[i].numPackets;
+            unsigned int framesReceived = 0;
+            size_t headerSize = getFrameHeaderSize(video.payload, pFrame->streamType);
+            size_t bytesProcessed = processVideoFrames(video.payload.contiguous(headerSize), headerSize, pFrame);
+            //compact_video_data(bytesProcessed);
+            popVideoData(video.payload);
+        }
 
-            if(m_bAnalyzeElementaryStream)
+        pFrame->totalPackets = 0;
+    }
+}
+
+// Process each PID (Packet Identifier) for each 188 byte packet
+void mptsParser::processPAT(const mptsSection& section)
+{
+    program_association_table pat;
+    readPAT(section, pat);
+
+    printfXml(2, "<program_association_table>\n");
+    if (pat.payload_unit_start)
+        printfXml(3, "<pointer_field>0x%x</pointer_field>\n", pat.payload_start_offset);
+    printfXml(3, "<table_id>0x%x</table_id>\n", pat.table_id);
+    printfXml(3, "<section_syntax_indicator>%d</section_syntax_indicator>\n", pat.section_syntax_indicator);
+    printfXml(3, "<section_length>%d</section_length>\n", pat.section_length);
+    printfXml(3, "<transport_stream_id>0x%x</transport_stream_id>\n", pat.transport_stream_id);
+    printfXml(3, "<version_number>0x%x</version_number>\n", pat.version_number);
+    printfXml(3, "<current_next_indicator>0x%x</current_next_indicator>\n", pat.current_next_indicator);
+    printfXml(3, "<section_number>0x%x</section_number>\n", pat.section_number);
+    printfXml(3, "<last_section_number>0x%x</last_section_number>\n", pat.last_section_number);
+
+    for (const auto [program_number, pid] : pat.program_numbers)
+    {
+        printfXml(3, "<program>\n");
+        printfXml(4, "<number>%d</number>\n", program_number);
+
+        if (0 == program_number)
+        {
+            printfXml(4, "<network_pid>0x%x</network_pid>\n", pid);
+            m_networkPid = pid;
+        }
+        else
+        {
+            printfXml(4, "<program_map_pid>0x%x</program_map_pid>\n", pid);
+            addProgram(program_number, pid);
+
+            if (m_pRecords)
             {
-                unsigned int framesReceived = 0;
-                size_t bytesProcessed = processVideoFrames(m_pVideoData, m_videoDataSize, pFrame);
-                //compact_video_data(bytesProcessed);
-                popVideoData();
+                mptsRecord record = {};
+
+                record.type = eRecordProgram;
+                record.pid = pid;
+                record.value = program_number;
+
+                m_pRecords->write(record);
             }
+        }
 
-            pFrame->totalPackets = 0;
+        printfXml(3, "</program>\n");
+    }
+
+    printfXml(2, "</program_association_table>\n");
+}
+
+void mptsParser::processPMT(uint16_t pid, const mptsSection& section)
+{
+    program_map_table pmt;
+    readPMT(section, pmt);
+
+    // This has to be done by hand
+    m_pids[0x1FFF].pName = "NULL Packet";
+    // Programs may share a PMT PID, the section says which one this is
+    addProgram(pmt.program_number, pid);
+    setPcrPid(pmt.program_number, pmt.pcr_pid);
+
+    printfXml(2, "<program_map_table>\n");
+    if (pmt.payload_unit_start)
+        printfXml(3, "<pointer_field>0x%x</pointer_field>\n", pmt.payload_start_offset);
+    printfXml(3, "<table_id>0x%x</table_id>\n", pmt.table_id);
+    printfXml(3, "<section_syntax_indicator>%d</section_syntax_indicator>\n", pmt.section_syntax_indicator);
+    printfXml(3, "<section_length>%d</section_length>\n", pmt.section_length);
+    printfXml(3, "<program_number>%d</program_number>\n", pmt.program_number);
+    printfXml(3, "<version_number>%d</version_number>\n", pmt.version_number);
+    printfXml(3, "<current_next_indicator>%d</current_next_indicator>\n", pmt.current_next_indicator);
+    printfXml(3, "<section_number>%d</section_number>\n", pmt.section_number);
+    printfXml(3, "<last_section_number>%d</last_section_number>\n", pmt.last_section_number);
+    printfXml(3, "<pcr_pid>0x%x</pcr_pid>\n", pmt.pcr_pid);
+    printfXml(3, "<program_info_length>%d</program_info_length>\n", pmt.program_info_length);
+
+    printElementDescriptors(pmt);
+
+    size_t stream_count = 0;
+
+    for (const auto [stream_type, elementary_pid, es_info_length] : pmt.program_elements)
+    {
+        // Scte35 stream type is 0x86
+        if (0x86 == stream_type)
+            m_scte35Pid = elementary_pid;
+
+        m_pids[elementary_pid].pName = getStreamTypeName(stream_type);
+        m_pids[elementary_pid].streamType = (eMptsStreamType)stream_type;
+        m_bProgramInfo |= (eReserved != stream_type);
+
+        if (m_pStats)
+            m_pStats->setStreamType(elementary_pid, stream_type, getStreamTypeName(stream_type));
+
+        if (m_pRecords)
+        {
+            mptsRecord record = {};
+
+            record.type = eRecordStream;
+            record.flags = stream_type;
+            record.pid = elementary_pid;
+            record.value = pmt.program_number;
+
+            m_pRecords->write(record);
         }
+
+        printfXml(3, "<stream>\n");
+        printfXml(4, "<number>%zd</number>\n", stream_count);
+        printfXml(4, "<pid>0x%x</pid>\n", elementary_pid);
+        printfXml(4, "<type_number>0x%x</type_number>\n", stream_type);
+        printfXml(4, "<type_name>%s</type_name>\n", getStreamTypeName(stream_type));
+        printfXml(3, "</stream>\n");
+
+        stream_count++;
     }
+
+    printfXml(2, "</program_map_table>\n");
 }
 
-// Process each PID (Packet Identifier) for each 188 byte packet
 // https://en.wikipedia.org/wiki/MPEG_transport_stream#Packet_identifier_(PID)
 // https://www.linuxtv.org/wiki/index.php/PID
 /*
@@ -2419,147 +2424,108 @@ Decimal	    Hexadecimal	    Description
 
 int16_t mptsParser::processPid(uint16_t pid, uint8_t *&packetStart, uint8_t *&p, int64_t packetStartInFile, size_t packetNum, bool payloadUnitStart, uint8_t adaptationFieldLength)
 {
-    static size_t lastPid = -1;
-
-    if(ePAT == pid) // PAT - Program Association Table
+    if(isPsiPid(pid)) // PAT - Program Association Table, or a PMT - Program Map Table
     {
-        if(m_bTerse)
-        {
-            printfXml(1, "<packet start=\"%llu\">\n", packetStartInFile);
-            printfXml(2, "<number>%zd</number>\n", packetNum);
-            printfXml(2, "<pid>0x%x</pid>\n", pid);
-            printfXml(2, "<payload_unit_start_indicator>0x%x</payload_unit_start_indicator>\n", payloadUnitStart ? 1 : 0);
-        }
+        mptsPidInfo &info = m_pids[pid];
 
-        program_association_table pat;
-        readPAT(p, pat, payloadUnitStart);
+        if(nullptr == info.pSections)
+            info.pSections = std::make_shared<mptsSectionAssembler>();
 
-        printfXml(2, "<program_association_table>\n");
-        if (pat.payload_unit_start)
-            printfXml(3, "<pointer_field>0x%x</pointer_field>\n", pat.payload_start_offset);
-        printfXml(3, "<table_id>0x%x</table_id>\n", pat.table_id);
-        printfXml(3, "<section_syntax_indicator>%d</section_syntax_indicator>\n", pat.section_syntax_indicator);
-        printfXml(3, "<section_length>%d</section_length>\n", pat.section_length);
-        printfXml(3, "<transport_stream_id>0x%x</transport_stream_id>\n", pat.transport_stream_id);
-        printfXml(3, "<version_number>0x%x</version_number>\n", pat.version_number);
-        printfXml(3, "<current_next_indicator>0x%x</current_next_indicator>\n", pat.current_next_indicator);
-        printfXml(3, "<section_number>0x%x</section_number>\n", pat.section_number);
-        printfXml(3, "<last_section_number>0x%x</last_section_number>\n", pat.last_section_number);
+        // Packets with only an adaptation field carry nothing
+        size_t payloadSize = 0;
 
-        for (const auto [program_number, pid] : pat.program_numbers)
+        if(p + adaptationFieldLength < packetStart + m_packetSize)
         {
-            printfXml(3, "<program>\n");
-            printfXml(4, "<number>%d</number>\n", program_number);
-
-            if (0 == program_number)
-            {
-                printfXml(4, "<network_pid>0x%x</network_pid>\n", pid);
-                m_networkPid = pid;
-            }
-            else
-            {
-                printfXml(4, "<program_map_pid>0x%x</program_map_pid>\n", pid);
-                m_programMapPid = pid;
-            }
-
-            printfXml(3, "</program>\n");
+            p += adaptationFieldLength;
+            payloadSize = packetStart + m_packetSize - p;
         }
 
-        printfXml(2, "</program_association_table>\n");
+        size_t sectionCount = info.pSections->push(p, payloadSize, payloadUnitStart);
+        bool bPrinted = false;
 
-        if(m_bTerse)
-            printfXml(1, "</packet>\n");
-    }
-    else if(m_programMapPid == pid)
-    {
-        if(m_bTerse)
+        for(size_t i = 0; i < sectionCount; i++)
         {
-            printfXml(1, "<packet start=\"%llu\">\n", packetStartInFile);
-            printfXml(2, "<number>%zd</number>\n", packetNum);
-            printfXml(2, "<pid>0x%x</pid>\n", pid);
-            printfXml(2, "<payload_unit_start_indicator>0x%x</payload_unit_start_indicator>\n", payloadUnitStart ? 1 : 0);
-        }
-
-        program_map_table pmt;
-        readPMT(p, pmt, payloadUnitStart);
+            const mptsSection &section = info.pSections->getSection(i);
 
-        // This has to be done by hand
-        m_pidToNameMap[0x1FFF] = "NULL Packet";
-        m_pidToNameMap[pmt.pcr_pid] = "PCR";
+            // Only the current PAT on PID 0, and current PMTs on the PMT PIDs. Private and short form sections,
+            // tables that are not yet in force and anything too short to be a table are counted and skipped.
+            if(section.bCrcValid && (section.size < SECTION_MIN_SIZE || 0 == (section.pData[1] & 0x80) ||
+                0 == (section.pData[5] & 0x01) || section.pData[0] != (ePAT == pid ? 0x00 : 0x02)))
+            {
+                m_skippedSections++;
+                continue;
+            }
 
-        printfXml(2, "<program_map_table>\n");
-        if (pmt.payload_unit_start)
-            printfXml(3, "<pointer_field>0x%x</pointer_field>\n", pmt.payload_start_offset);
-        printfXml(3, "<table_id>0x%x</table_id>\n", pmt.table_id);
-        printfXml(3, "<section_syntax_indicator>%d</section_syntax_indicator>\n", pmt.section_syntax_indicator);
-        printfXml(3, "<section_length>%d</section_length>\n", pmt.section_length);
-        printfXml(3, "<program_number>%d</program_number>\n", pmt.program_number);
-        printfXml(3, "<version_number>%d</version_number>\n", pmt.version_number);
-        printfXml(3, "<current_next_indicator>%d</current_next_indicator>\n", pmt.current_next_indicator);
-        printfXml(3, "<section_number>%d</section_number>\n", pmt.section_number);
-        printfXml(3, "<last_section_number>%d</last_section_number>\n", pmt.last_section_number);
-        printfXml(3, "<pcr_pid>0x%x</pcr_pid>\n", pmt.pcr_pid);
-        printfXml(3, "<program_info_length>%d</program_info_length>\n", pmt.program_info_length);
+            // Tables that come round again unchanged are only counted
+            if(section.bCrcValid && m_pTables && m_pTables->isRepeat(pid, section))
+                continue;
 
-        printElementDescriptors(pmt);
+            // The packet that completes a section stands for it
+            if(m_bTerse && false == bPrinted)
+            {
+                printfXml(1, "<packet start=\"%llu\">\n", packetStartInFile);
+                printfXml(2, "<number>%zd</number>\n", packetNum);
+                printfXml(2, "<pid>0x%x</pid>\n", pid);
+                printfXml(2, "<payload_unit_start_indicator>0x%x</payload_unit_start_indicator>\n", payloadUnitStart ? 1 : 0);
+            }
 
-        std::map <uint16_t, const char*> streamMap; // ID, name
-        initStreamTypes(streamMap);
-        size_t stream_count = 0;
+            bPrinted = true;
 
-        for (const auto [stream_type, elementary_pid, es_info_length] : pmt.program_elements)
-        {
-            // Scte35 stream type is 0x86
-            if (0x86 == stream_type)
-                m_scte35Pid = elementary_pid;
+            if(m_pRecords && section.bCrcValid)
+            {
+                mptsRecord record = {};
 
-            m_pidToNameMap[elementary_pid] = streamMap[stream_type];
-            m_pidToTypeMap[elementary_pid] = (eMptsStreamType)stream_type;
+                record.type = eRecordTable;
+                record.flags = (section.pData[5] >> 1) & 0x1F;
+                record.pid = pid;
+                record.value = section.pData[0] | (util::read2Bytes((uint8_t *) section.pData + 3) << 16);
+                record.number = packetNum;
+                record.position = packetStartInFile;
 
-            printfXml(3, "<stream>\n");
-            printfXml(4, "<number>%zd</number>\n", stream_count);
-            printfXml(4, "<pid>0x%x</pid>\n", elementary_pid);
-            printfXml(4, "<type_number>0x%x</type_number>\n", stream_type);
-            printfXml(4, "<type_name>%s</type_name>\n", streamMap[stream_type]);
-            printfXml(3, "</stream>\n");
+                m_pRecords->write(record);
+            }
 
-            stream_count++;
+            if(false == section.bCrcValid)
+                printfXml(2, "<error>CRC_32 mismatch in section with table_id 0x%x on PID 0x%x, section ignored</error>\n", section.pData[0], pid);
+            else if(ePAT == pid)
+                processPAT(section);
+            else if(section.size < PMT_MIN_SECTION_SIZE)
+                printfXml(2, "<error>PMT section of %zd bytes on PID 0x%x is too short, section ignored</error>\n", section.size, pid);
+            else
+                processPMT(pid, section);
         }
 
-        printfXml(2, "</program_map_table>\n");
-
-        if(m_bTerse)
+        if(m_bTerse && bPrinted)
             printfXml(1, "</packet>\n");
     }
     else if(pid >= eAsNeededStart && pid <= eAsNeededEnd)
     {
+        mptsPidInfo &info = m_pids[pid];
+        uint8_t *pPayload = p + adaptationFieldLength;
+
         if(false == m_bTerse)
         {
             // Here, p is pointing at actual data, like video or audio.
             // For now just print the data's type.
-            printfXml(2, "<type_name>%s</type_name>\n", m_pidToNameMap[pid]);
+            printfXml(2, "<type_name>%s</type_name>\n", info.pName);
         }
         else
         {
-            mpts_frame *p_frame = nullptr;
+            mptsVideoStream *pVideo = nullptr;
 
-            switch(m_pidToTypeMap[pid])
+            switch(info.streamType)
             {
                 case eMPEG2_Video:
-                    if(nullptr == m_parser)
-                        m_parser = std::shared_ptr<baseParser>(new mpeg2Parser());
+                    if(nullptr == info.pParser)
+                        info.pParser = std::shared_ptr<baseParser>(new mpeg2Parser());
 
-                    p_frame = &m_videoFrame;
-                    p_frame->pid = pid;
-                    p_frame->streamType = eMPEG2_Video;
+                    pVideo = &getVideoStream(pid);
                 break;
                 case eH264_Video:
-                    if(nullptr == m_parser)
-                        m_parser = std::shared_ptr<baseParser>(new avcParser());
+                    if(nullptr == info.pParser)
+                        info.pParser = std::shared_ptr<baseParser>(new avcParser());
 
-                    p_frame = &m_videoFrame;
-                    p_frame->pid = pid;
-                    p_frame->streamType = eH264_Video;
+                    pVideo = &getVideoStream(pid);
                 break;
                 case eMPEG1_Video:
                 case eMPEG4_Video:
@@ -2583,25 +2549,34 @@ int16_t mptsParser::processPid(uint16_t pid, uint8_t *&packetStart, uint8_t *&p,
                 break;
             }
 
-            if(p_frame)
+            if(pVideo)
             {
+                mpts_frame *p_frame = &pVideo->frame;
                 bool bNewSet = false;
 
+                // The start of this frame was before the part being parsed
+                if(m_bSkipPartialFrames && p_frame->pidList.empty() && false == payloadUnitStart)
+                {
+                    m_lastPid = pid;
+                    return 0;
+                }
+
                 if(payloadUnitStart)
                 {
                     // When we get the start of a new payload decode and gather information about the previous payload
-                    printFrameInfo(p_frame);
+                    printFrameInfo(*pVideo);
 
                     p_frame->pidList.clear();
                     bNewSet = true;
                 }
 
-                if(-1 != lastPid && pid != lastPid)
+                // Each video PID gathers its own frame, a frame that began before the parse did starts here
+                if((-1 != m_lastPid && pid != m_lastPid) || p_frame->pidList.empty())
                     bNewSet = true;
 
                 if(bNewSet)
                 {
-                    mptsPidEntryType pet(m_pidToNameMap[pid], 1, packetStartInFile);
+                    mptsPidEntryType pet(info.pName, 1, packetStartInFile);
                     p_frame->pidList.push_back(pet);
                 }
                 else
@@ -2613,16 +2588,72 @@ int16_t mptsParser::processPid(uint16_t pid, uint8_t *&packetStart, uint8_t *&p,
                 p += adaptationFieldLength;
 
                 if(p - packetStart != m_packetSize)
-                    processPESPacket(packetStart, p, m_pidToTypeMap[pid], payloadUnitStart);
+                    processPESPacket(packetStart, p, pVideo->payload, info.streamType, payloadUnitStart);
             }
         }
+
+        // After the frame this PES packet ends, so the records stay in stream order
+        if(m_pRecords && payloadUnitStart && eReserved != info.streamType && pPayload < packetStart + m_packetSize)
+            recordPes(pid, pPayload, packetStart + m_packetSize, packetStartInFile, packetNum);
     }
 
-    lastPid = pid;
+    m_lastPid = pid;
 
     return 0;
 }
 
+// Record the PES packet that starts at p, pEnd is the end of its transport packet
+void mptsParser::recordPes(uint16_t pid, uint8_t *p, const uint8_t *pEnd, int64_t position, size_t packetNum)
+{
+    // Start code, stream_id and PES_packet_length
+    if(p + 6 > pEnd || 0x000001 != util::read3Bytes(p))
+        return;
+
+    mptsRecord record = {};
+
+    record.type = eRecordPes;
+    record.pid = pid;
+    record.value = p[3];
+    record.number = packetNum;
+    record.position = position;
+
+    switch(p[3])
+    {
+        // These have no optional PES header, so no time stamps
+        case program_stream_map:
+        case padding_stream:
+        case private_stream_2:
+        case ECM_stream:
+        case EMM_stream:
+        case program_stream_directory:
+        case DSMCC_stream:
+        case itu_h222_e_stream:
+        break;
+
+        default:
+        {
+            uint8_t PTS_DTS_flags = (p + 9 <= pEnd) ? (p[7] & 0xC0) >> 6 : 0;
+            uint8_t *pTime = p + 9;
+
+            if(PTS_DTS_flags >= 2 && pTime + 5 <= pEnd)
+            {
+                record.pts = readTimeStamp(pTime);
+                record.dts = record.pts;
+                record.flags = 2;
+
+                if(3 == PTS_DTS_flags && pTime + 5 <= pEnd)
+                {
+                    record.dts = readTimeStamp(pTime);
+                    record.flags = 3;
+                }
+            }
+        }
+        break;
+    }
+
+    m_pRecords->write(record);
+}
+
 uint8_t mptsParser::getAdaptationFieldLength(uint8_t *&p)
 {
     uint8_t adaptation_field_length = *p;
@@ -2761,6 +2792,32 @@ uint8_t mptsParser::processAdaptationField(unsigned int indent, uint8_t *&p)
 
 // Get the PID and other info
 int16_t mptsParser::processPacket(uint8_t *packet, size_t packetNum)
+{
+    m_headers.decode(packet, 1, m_packetSize);
+
+    if(m_pContinuity)
+        m_pContinuity->check(m_headers, packet, m_packetSize, m_filePosition);
+
+    if(m_pPcr)
+        m_pPcr->check(m_headers, packet, m_packetSize, m_filePosition);
+
+    if(m_pStats)
+    {
+        if(isPidWanted(m_headers.pid[0]))
+            m_pStats->check(m_headers, 0, 1, packet, m_packetSize);
+
+        if(false == isPsiPid(m_headers.pid[0]))
+            return 0;
+    }
+
+    if(false == isPidWanted(m_headers.pid[0]))
+        return 0;
+
+    return processPacket(packet, packetNum, 0);
+}
+
+// The header of the packet has already been decoded into m_headers at index
+int16_t mptsParser::processPacket(uint8_t *packet, size_t packetNum, size_t index)
 {
     uint8_t *p = NULL;
     int16_t ret = 0;
@@ -2774,10 +2831,10 @@ int16_t mptsParser::processPacket(uint8_t *packet, size_t packetNum)
 
     p = packet;
 
-    if (SYNC_BYTE != *p)
+    if (m_headers.flags[index] & eHeaderBadSync)
     {
+        // Input from main.cpp is aligned by mptsSync, which counts lost bytes itself
         printfXml(2, "<error>Packet %zd does not start with 0x47</error>\n", packetNum);
-        fprintf(stderr, "Error: Packet %zd does not start with 0x47\n", packetNum);
 
         if(false == m_bTerse)
             printfXml(1, "</packet>\n");
@@ -2785,26 +2842,38 @@ int16_t mptsParser::processPacket(uint8_t *packet, size_t packetNum)
         return ret;
     }
 
-    // Skip the sync byte 0x47
-    incPtr(p, 1);
-
-    uint16_t pid = util::read2Bytes(p);
-    incPtr(p, 2);
-
-    uint8_t transport_error_indicator = (pid & 0x8000) >> 15;
-    uint8_t payload_unit_start_indicator = (pid & 0x4000) >> 14;
+    // Move beyond the 32 bit header
+    incPtr(p, 4);
 
-    uint8_t transport_priority = (pid & 0x2000) >> 13;
+    uint16_t pid = m_headers.pid[index];
+    uint8_t flags = m_headers.flags[index];
 
-    pid &= 0x1FFF;
+    uint8_t transport_error_indicator = (flags & eHeaderTransportError) ? 1 : 0;
+    uint8_t payload_unit_start_indicator = (flags & eHeaderPayloadUnitStart) ? 1 : 0;
+    uint8_t transport_priority = (flags & eHeaderTransportPriority) ? 1 : 0;
 
-    // Move beyond the 32 bit header
-    uint8_t final_byte = *p;
-    incPtr(p, 1);
+    uint8_t transport_scrambling_control = m_headers.scramblingControl[index];
+    uint8_t adaptation_field_control = m_headers.adaptationFieldControl[index];
+    uint8_t continuity_counter = m_headers.continuityCounter[index];
 
-    uint8_t transport_scrambling_control = (final_byte & 0xC0) >> 6;
-    uint8_t adaptation_field_control = (final_byte & 0x30) >> 4;
-    uint8_t continuity_counter = (final_byte & 0x0F);
+    if(m_pRecords && false == m_bTerse)
+    {
+        mptsRecord record = {};
+
+        record.type = eRecordPacket;
+        record.flags = (payload_unit_start_indicator ? eRecordPayloadUnitStart : 0) |
+                       (transport_error_indicator ? eRecordTransportError : 0) |
+                       (transport_priority ? eRecordTransportPriority : 0) |
+                       (transport_scrambling_control ? eRecordScrambled : 0) |
+                       ((adaptation_field_control & 2) ? eRecordAdaptationField : 0) |
+                       ((adaptation_field_control & 1) ? eRecordPayload : 0);
+        record.pid = pid;
+        record.value = continuity_counter;
+        record.number = packetNum;
+        record.position = packetStartInFile;
+
+        m_pRecords->write(record);
+    }
 
     if(false == m_bTerse)
     {
@@ -2840,6 +2909,103 @@ int16_t mptsParser::processPacket(uint8_t *packet, size_t packetNum)
     return ret;
 }
 
+// The stride is a template argument so the loop is compiled separately for each packet size
+template<unsigned int stride>
+int16_t mptsParser::processPacketRun(const uint8_t *data, size_t count, size_t packetNum)
+{
+    // The sync byte comes after the 4 byte timecode of 192 byte packets
+    const unsigned int syncOffset = (192 == stride) ? 4 : 0;
+
+    uint8_t *packet = const_cast<uint8_t *>(data) + syncOffset;
+    int64_t position = m_filePosition;
+
+    while(count)
+    {
+        size_t batch = (count < HEADER_BATCH_SIZE) ? count : HEADER_BATCH_SIZE;
+
+        m_headers.decode(packet, batch, stride);
+
+        if(m_pContinuity)
+            m_pContinuity->check(m_headers, packet, stride, position);
+
+        if(m_pPcr)
+            m_pPcr->check(m_headers, packet, stride, position);
+
+        if(m_pStats)
+        {
+            // Only the program tables are parsed, to learn what the PIDs carry.
+            // The packets before each one are counted first, so it applies from where it is.
+            // Packets filtered out end a run of counted packets without being counted.
+            size_t counted = 0;
+
+            for(size_t i = 0; i < batch; i++)
+            {
+                bool bPsi = isPsiPid(m_headers.pid[i]);
+
+                if(false == bPsi && isPidWanted(m_headers.pid[i]))
+                    continue;
+
+                m_pStats->check(m_headers, counted, bPsi ? i + 1 : i, packet, stride);
+                counted = i + 1;
+
+                if(false == bPsi)
+                    continue;
+
+                m_filePosition = position + i * stride;
+
+                int16_t ret = processPacket(packet + i * stride, packetNum + i, i);
+
+                if(0 != ret)
+                    return ret;
+            }
+
+            m_pStats->check(m_headers, counted, batch, packet, stride);
+
+            packet += batch * stride;
+            position += batch * stride;
+            packetNum += batch;
+            count -= batch;
+            continue;
+        }
+
+        for(size_t i = 0; i < batch; i++, packet += stride, position += stride, packetNum++)
+        {
+            // Filtered out packets are dropped before anything past the header is read
+            if(false == isPidWanted(m_headers.pid[i]))
+                continue;
+
+            // processPacket() moves the file position on as it reads, put it back at the packet start
+            m_filePosition = position;
+
+            int16_t ret = processPacket(packet, packetNum, i);
+
+            if(0 != ret)
+                return ret;
+        }
+
+        count -= batch;
+    }
+
+    return 0;
+}
+
+int16_t mptsParser::processPackets(const uint8_t *data, size_t count, unsigned int stride, size_t packetNum)
+{
+    switch(stride)
+    {
+        case 188:
+            return processPacketRun<188>(data, count, packetNum);
+        case 192:
+            return processPacketRun<192>(data, count, packetNum);
+        case 204:
+            return processPacketRun<204>(data, count, packetNum);
+        default:
+        break;
+    }
+
+    return -1;
+}
+
 // 2.4.3.6 PES Packet
 //
 // Return a 33 bit number representing the time stamp
@@ -2994,10 +3160,9 @@ size_t mptsParser::processVideoFrames(uint8_t* p,
     uint8_t* pStart = p;
     size_t bytesProcessed = 0;
     bool bDone = false;
-    PES_packet pes_packet;
+    PES_packet pes_packet = {};
     unsigned int framesReceived = 0;
     unsigned int framesWanted = 1;
-    static unsigned int frameNumber = 0;
 
     while (bytesProcessed < (PESPacketDataLength - 4) && !bDone)
     {
@@ -3052,14 +3217,38 @@ size_t mptsParser::processVideoFrames(uint8_t* p,
             {
                 NALData returnData = { 0 };
                 std::any a = &returnData;
-                bytesProcessed += m_parser->processVideoFrame(p, PESPacketDataLength - bytesProcessed, a);
+                bytesProcessed += m_pids[pFrame->pid].pParser->processVideoFrame(p, PESPacketDataLength - bytesProcessed, a);
                 framesReceived = framesWanted;
 
                 // NALData here
                 printNalData(returnData);
 
+                if (m_pRecords && returnData.sequence_parameter_set.profile_idc)
+                {
+                    mptsRecord record = {};
+
+                    record.type = eRecordSequence;
+                    record.flags = returnData.sequence_parameter_set.profile_idc;
+                    record.pid = pFrame->pid;
+                    record.value = returnData.sequence_parameter_set.level_idc;
+                    record.number = m_frameCount;
+
+                    m_pRecords->write(record);
+                }
+
+                // The type of the first slice, primary_pic_type only lists the slice types the picture may use
+                char frameType = 0;
+
+                if (eAVCNaluType_CodedSliceIdrPicture == returnData.picture_type ||
+                    eAVCNaluType_CodedSliceNonIdrPicture == returnData.picture_type ||
+                    eAVCNaluType_CodedSliceAuxiliaryPicture == returnData.picture_type)
+                    frameType = "PBIPI"[returnData.slice_header.slice_type % 5];
+
+                if (m_pRecords)
+                    recordFrame(pFrame, m_frameCount, frameType, eAVCNaluType_CodedSliceIdrPicture == returnData.picture_type, pes_packet);
+
                 printfXml(1, "<frame number=\"%d\" name=\"%s\" packets=\"%d\" pid=\"0x%x\">\n",
-                    pFrame->frameNumber++, pFrame->pidList[0].pidName.c_str(), pFrame->totalPackets, pFrame->pid);
+                    m_frameCount++, pFrame->pidList[0].pidName.c_str(), pFrame->totalPackets, pFrame->pid);
 
                 printfXml(2, "<DTS>%llu (%f)</DTS>\n", pes_packet.DTS, convertTimeStamp(pes_packet.DTS));
                 printfXml(2, "<PTS>%llu (%f)</PTS>\n", pes_packet.PTS, convertTimeStamp(pes_packet.PTS));
@@ -3084,13 +3273,23 @@ size_t mptsParser::processVideoFrames(uint8_t* p,
             break;
 
             case eMPEG2_Video:
+            {
+                unsigned int frameNumber = m_frameCount++;
+
                 printfXml(1, "<frame number=\"%d\" name=\"%s\" packets=\"%d\" pid=\"0x%x\">\n",
-                    pFrame->frameNumber++, pFrame->pidList[0].pidName.c_str(), pFrame->totalPackets, pFrame->pid);
+                    frameNumber, pFrame->pidList[0].pidName.c_str(), pFrame->totalPackets, pFrame->pid);
 
                 printfXml(2, "<DTS>%llu (%f)</DTS>\n", pes_packet.DTS, convertTimeStamp(pes_packet.DTS));
                 printfXml(2, "<PTS>%llu (%f)</PTS>\n", pes_packet.PTS, convertTimeStamp(pes_packet.PTS));
 
-                bytesProcessed += m_parser->processVideoFrames(p, PESPacketDataLength - bytesProcessed, frameNumber, framesWanted, framesReceived);
+                bytesProcessed += m_pids[pFrame->pid].pParser->processVideoFrames(p, PESPacketDataLength - bytesProcessed, m_videoFrameNumber, framesWanted, framesReceived);
+
+                if (m_pRecords)
+                {
+                    mpeg2Parser *pParser = static_cast<mpeg2Parser *>(m_pids[pFrame->pid].pParser.get());
+                    uint8_t picture_coding_type = pParser->getPictureCodingType();
+                    recordFrame(pFrame, frameNumber, (picture_coding_type && picture_coding_type < 4) ? " IPB"[picture_coding_type] : 0, pParser->getGroupStart(), pes_packet);
+                }
 
                 printfXml(2, "<slices>\n");
 
@@ -3100,7 +3299,7 @@ size_t mptsParser::processVideoFrames(uint8_t* p,
                 printfXml(2, "</slices>\n");
 
                 printfXml(1, "</frame>\n");
-
+            }
             break;
 
             default:
@@ -3116,6 +3315,7 @@ size_t mptsParser::processVideoFrames(uint8_t* p,
 
 size_t mptsParser::processVideoFrames(uint8_t *p,
                                       size_t PESPacketDataLength,
+                                      uint16_t pid,
                                       eMptsStreamType streamType,
                                       unsigned int& frameNumber, // Will be incremented by 1 per parsed frame
                                       unsigned int framesWanted,
@@ -3178,7 +3378,8 @@ RETRY:
         //switch(streamType)
         //{
         //    case eMPEG2_Video:
-                bytesProcessed += m_parser->processVideoFrames(p, PESPacketDataLength - bytesProcessed, frameNumber, framesWanted, framesReceived);
+                // The parser of the video PID being gathered
+                bytesProcessed += m_pids[pid].pParser->processVideoFrames(p, PESPacketDataLength - bytesProcessed, frameNumber, framesWanted, framesReceived);
         //    break;
         //}
 
@@ -3189,21 +3390,207 @@ RETRY:
     return p - pStart;
 }
 
-// Is this mpts from an OTA broadcast (188 byte packets) or a BluRay (192 byte packets)?
-// See: https://github.com/lerks/BluRay/wiki/M2TS
-int mptsParser::determine_packet_size(uint8_t buffer[5])
+// A frame record, type is 'I', 'P', 'B' or 0 when it isn't known
+void mptsParser::recordFrame(const mpts_frame *pFrame, unsigned int frameNumber, char type, bool bGopStart, const PES_packet &pes_packet)
+{
+    mptsRecord record = {};
+
+    record.type = eRecordFrame;
+    record.flags = type | (bGopStart ? eRecordGopStart : 0);
+    record.pid = pFrame->pid;
+    record.value = pFrame->totalPackets;
+    record.number = frameNumber;
+    record.position = pFrame->pidList.size() ? pFrame->pidList[0].pidByteLocation : -1;
+    record.pts = pes_packet.PTS;
+    record.dts = pes_packet.DTS;
+
+    m_pRecords->write(record);
+}
+
+// Returns the on disk packet stride, 188, 192 or 204.
+// The packets themselves are always 188 bytes once the timecode or parity bytes are stepped over.
+int mptsParser::determine_packet_size(uint8_t *buffer, size_t bufferSize)
+{
+    return mptsSync::determinePacketSize(buffer, bufferSize);
+}
+
+void mptsParser::copyProgramInfo(const mptsParser &other)
+{
+    m_networkPid = other.m_networkPid;
+    m_scte35Pid = other.m_scte35Pid;
+    m_programs = other.m_programs;
+    m_bProgramInfo = other.m_bProgramInfo;
+
+    // The elementary stream parsers are not shared, each parser makes its own
+    for(size_t pid = 0; pid < ePidCount; pid++)
+    {
+        m_pids[pid].streamType = other.m_pids[pid].streamType;
+        m_pids[pid].pName = other.m_pids[pid].pName;
+        m_pids[pid].bPmt = other.m_pids[pid].bPmt;
+    }
+
+    for(const mptsProgram &program : m_programs)
+    {
+        if(m_pPcr && -1 != program.pcrPid)
+            m_pPcr->addPid(program.pcrPid);
+    }
+
+    if(m_pStats)
+        copyStreamTypes(*m_pStats);
+
+    if(m_pTables && other.m_pTables)
+        m_pTables->copyTables(*other.m_pTables);
+}
+
+// Tell stats what each PID listed so far carries
+void mptsParser::copyStreamTypes(mptsStats &stats) const
+{
+    for(uint16_t pid = 0; pid < ePidCount; pid++)
+    {
+        if(eReserved != m_pids[pid].streamType)
+            stats.setStreamType(pid, m_pids[pid].streamType, m_pids[pid].pName);
+    }
+}
+
+void mptsParser::setCheckContinuity(bool tf)
+{
+    if(false == tf)
+        m_pContinuity.reset();
+    else if(nullptr == m_pContinuity)
+        m_pContinuity.reset(new mptsContinuity);
+}
+
+void mptsParser::setAnalyzePcr(bool tf, bool bJoined)
+{
+    if(false == tf)
+        m_pPcr.reset();
+    else if(nullptr == m_pPcr)
+    {
+        m_pPcr.reset(new mptsPcr(bJoined));
+
+        for(const mptsProgram &program : m_programs)
+        {
+            if(-1 != program.pcrPid)
+                m_pPcr->addPid(program.pcrPid);
+        }
+    }
+}
+
+void mptsParser::setStatsOnly(bool tf)
+{
+    if(false == tf)
+        m_pStats.reset();
+    else if(nullptr == m_pStats)
+    {
+        m_pStats.reset(new mptsStats);
+        copyStreamTypes(*m_pStats);
+    }
+}
+
+void mptsParser::setSkipRepeatedTables(bool tf)
+{
+    if(false == tf)
+        m_pTables.reset();
+    else if(nullptr == m_pTables)
+        m_pTables.reset(new mptsTableCache);
+}
+
+void mptsParser::setPidFilter(const std::vector<uint16_t> &pids)
+{
+    m_pidFilter.reset();
+
+    for(uint16_t pid : pids)
+        m_pidFilter.set(pid & 0x1FFF);
+
+    m_bPidFilter = (pids.size() > 0);
+}
+
+// True once a PMT has listed a stream, and every program of the PAT has had its PMT read
+bool mptsParser::hasProgramInfo() const
+{
+    for(const mptsProgram &program : m_programs)
+    {
+        if(-1 == program.pcrPid)
+            return false;
+    }
+
+    return m_bProgramInfo;
+}
+
+// Only these stream types are gathered into frames, see processPid()
+bool mptsParser::isVideoPid(uint16_t pid) const
 {
-    if(SYNC_BYTE == buffer[0])
-        m_packetSize = 188;
-    else if(SYNC_BYTE == buffer[4])
-        m_packetSize = 192;
-    else
-        return -1;
-
-    return m_packetSize;
+    eMptsStreamType streamType = m_pids[pid & 0x1FFF].streamType;
+
+    return eMPEG2_Video == streamType || eH264_Video == streamType;
 }
 
+bool mptsParser::hasOpenFrames() const
+{
+    for(const mptsPidInfo &info : m_pids)
+    {
+        if(info.pVideo && info.pVideo->frame.pidList.size())
+            return true;
+    }
+
+    return false;
+}
+
+bool mptsParser::finishFrames(const uint8_t *data, size_t count, unsigned int stride)
+{
+    const unsigned int syncOffset = (192 == stride) ? 4 : 0;
+
+    uint8_t *packet = const_cast<uint8_t *>(data) + syncOffset;
+    int64_t position = m_filePosition;
+    bool bOpen = hasOpenFrames();
+
+    for(size_t i = 0; i < count && bOpen; i++, packet += stride, position += stride)
+    {
+        m_headers.decode(packet, 1, stride);
+
+        uint16_t pid = m_headers.pid[0];
+        mptsVideoStream *pVideo = m_pids[pid].pVideo.get();
+
+        if(pVideo && pVideo->frame.pidList.size() && isPidWanted(pid))
+        {
+            // The next frame starts, this one is complete
+            if(m_headers.flags[0] & eHeaderPayloadUnitStart)
+            {
+                printFrameInfo(*pVideo);
+                pVideo->frame.pidList.clear();
+                bOpen = hasOpenFrames();
+            }
+            else
+            {
+                m_filePosition = position;
+                processPacket(packet, 0, 0);
+            }
+        }
+
+        m_lastPid = pid;
+    }
+
+    return bOpen;
+}
+
+// Print the frame each video PID is still gathering, in the order they began
 void mptsParser::flush()
 {
-    printFrameInfo(&m_videoFrame);
+    std::vector<mptsVideoStream *> pending;
+
+    for(mptsPidInfo &info : m_pids)
+    {
+        if(info.pVideo && info.pVideo->frame.pidList.size())
+            pending.push_back(info.pVideo.get());
+    }
+
+    std::sort(pending.begin(), pending.end(), [](const mptsVideoStream *a, const mptsVideoStream *b) {
+        return a->frame.pidList[0].pidByteLocation < b->frame.pidList[0].pidByteLocation;
+    });
+
+    for(mptsVideoStream *pVideo : pending)
+    {
+        printFrameInfo(*pVideo);
+        pVideo->frame.pidList.clear();
+    }
 }
@@ -29,9 +29,17 @@
 #include <map>
 #include <memory>
 #include <any>
+#include <bitset>
 #include <cstdint>
 #include <base_parser.h>
 #include "mpts_descriptors.h"
+#include "mpts_payload.h"
+#include "mpts_headers.h"
+#include "mpts_continuity.h"
+#include "mpts_pcr.h"
+#include "mpts_stats.h"
+#include "mpts_section.h"
+#include "mpts_records.h"
 #include "util.h"
 
 // Type definitions
@@ -198,7 +206,8 @@ enum eMptsPacketIdentifier
     eAsNeededStart = 0x10,
     eAsNeededEnd = 0x1FFE,
     eDigiCipher = 0x1FFB,
-    eNull = 0x1FFF
+    eNull = 0x1FFF,
+    ePidCount = 0x2000 // Size of tables indexed by PID
 };
 
 struct mptsPidEntryType
@@ -220,19 +229,59 @@ typedef std::vector<mptsPidEntryType> mptsPidListType;
 struct mpts_frame
 {
     int pid;
-    unsigned int frameNumber;
     int totalPackets;
     mptsPidListType pidList;
     eMptsStreamType streamType;
 
     mpts_frame()
         : pid(-1)
-        , frameNumber(0)
         , totalPackets(0)
         , streamType(eReserved)
     {}
 };
 
+// The frame being gathered on a video PID
+struct mptsVideoStream
+{
+    mptsVideoStream(mptsBufferPool &pool, uint16_t pid)
+        : payload(pool, pid)
+    {}
+
+    mpts_frame frame;
+    mptsPayload payload;
+};
+
+// What the parser knows about one PID, mostly from the PMT
+struct mptsPidInfo
+{
+    eMptsStreamType streamType;             // eReserved until a PMT lists the PID
+    const char *pName;                      // Stream type name, "PCR" or "NULL Packet", nullptr when unknown
+    bool bPmt;                              // The PAT lists it as the PMT PID of a program
+    std::shared_ptr<baseParser> pParser;    // Elementary stream parser of a video PID, made the first time it is needed
+    std::shared_ptr<mptsVideoStream> pVideo;    // Frame of a video PID, made with pParser
+    std::shared_ptr<mptsSectionAssembler> pSections;    // Sections of the PAT or a PMT PID, made with its first packet
+
+    mptsPidInfo()
+        : streamType(eReserved)
+        , pName(nullptr)
+        , bPmt(false)
+    {}
+};
+
+// A program the PAT lists
+struct mptsProgram
+{
+    uint16_t programNumber;
+    uint16_t pmtPid;
+    int16_t pcrPid;     // -1 until its PMT has been read
+
+    mptsProgram(uint16_t programNumber, uint16_t pmtPid)
+        : programNumber(programNumber)
+        , pmtPid(pmtPid)
+        , pcrPid(-1)
+    {}
+};
+
 // Table 2-30 – Program association section
 struct program_pid
 {
@@ -389,27 +438,33 @@ struct PES_packet
 class mptsParser
 {
 public:
-    mptsParser(size_t &filePosition);
+    mptsParser(int64_t &filePosition);
     ~mptsParser();
 
-    int determine_packet_size(uint8_t buffer[5]);
+    int determine_packet_size(uint8_t *buffer, size_t bufferSize);
 
-    size_t readPAT(uint8_t *&p, bool payloadUnitStart);
-    size_t readPAT(uint8_t*& p, program_association_table& pat, bool payloadUnitStart);
-    size_t readPMT(uint8_t *&p, bool payloadUnitStart);
-    size_t readPMT(uint8_t*& p, program_map_table& pmt, bool payloadUnitStart);
+    // Read a complete section from an mptsSectionAssembler
+    size_t readPAT(const mptsSection& section, program_association_table& pat);
+    size_t readPMT(const mptsSection& section, program_map_table& pmt);
+    void processPAT(const mptsSection& section);
+    void processPMT(uint16_t pid, const mptsSection& section);
     size_t readElementDescriptors(uint8_t* p, program_map_table& pmt);
     size_t readElementDescriptors(uint8_t* p, uint16_t programInfoLength);
 
     size_t processPESPacketHeader(uint8_t*& p, size_t PESPacketDataLength, PES_packet& pes_packet);
     size_t processPESPacketHeader(uint8_t *&p, size_t PESPacketDataLength);
-    size_t processPESPacket(uint8_t *&packetStart, uint8_t *&p, eMptsStreamType streamType, bool payloadUnitStart);
+    size_t processPESPacket(uint8_t *&packetStart, uint8_t *&p, mptsPayload &payload, eMptsStreamType streamType, bool payloadUnitStart);
     int16_t processPid(uint16_t pid, uint8_t *&packetStart, uint8_t *&p, int64_t packetStartInFile, size_t packetNum, bool payloadUnitStart, uint8_t adaptationFieldLength);
     uint8_t getAdaptationFieldLength(uint8_t *&p);
     uint8_t processAdaptationField(unsigned int indent, uint8_t *&p);
     int16_t processPacket(uint8_t *packet, size_t packetNum);
+
+    // Process count packets laid out stride (188, 192 or 204) bytes apart, data pointing at the first one.
+    // The file position passed to the constructor must hold the position of data in the file.
+    int16_t processPackets(const uint8_t *data, size_t count, unsigned int stride, size_t packetNum);
     size_t processVideoFrames(uint8_t* p,
         size_t PESPacketDataLength,
+        uint16_t pid,
         eMptsStreamType streamType,
         unsigned int& frameNumber, // Will be incremented by 1 per parsed frame
         unsigned int framesWanted,
@@ -418,12 +473,50 @@ public:
         size_t PESPacketDataLength,
         mpts_frame* pFrame);
 
-    size_t pushVideoData(uint8_t *p, size_t size);
-    size_t popVideoData();
-    size_t compactVideoData(size_t bytesToCompact);
-    size_t getVideoDataSize();
+    size_t pushVideoData(mptsPayload &payload, uint8_t *p, size_t size);
+    size_t popVideoData(mptsPayload &payload);
+
+    // Video payloads inside this block are referenced instead of copied.
+    // The block must stay valid until the frames in it have been printed, like the blocks of an mmapReader.
+    void setPinnedBlock(uint8_t *p, size_t size) { m_pPinnedStart = p; m_pPinnedEnd = p + size; }
+
+    // Only parse packets of these PIDs, and the PAT and PMT which are always parsed.
+    // An empty list parses every packet.
+    void setPidFilter(const std::vector<uint16_t> &pids);
+    bool isPidWanted(uint16_t pid) const { return false == m_bPidFilter || m_pidFilter[pid] || isPsiPid(pid); }
+    bool isPsiPid(uint16_t pid) const { return ePAT == pid || m_pids[pid].bPmt; }
 
-    void printFrameInfo(mpts_frame *pFrame);
+    // Check the continuity counters of every packet, before the PID filter.
+    // getContinuity() is nullptr unless this was turned on.
+    void setCheckContinuity(bool tf);
+    const mptsContinuity *getContinuity() const { return m_pContinuity.get(); }
+
+    // Collect the PCRs of each program's pcr_pid, getPcr() is nullptr unless this was turned on.
+    // bJoined when the packets are of a part of the stream that mptsPcr::append() adds on to the part before.
+    void setAnalyzePcr(bool tf, bool bJoined = false);
+    const mptsPcr *getPcr() const { return m_pPcr.get(); }
+
+    // Only count packets, frames and frame types per PID, past the header nothing but the
+    // PAT and PMT is parsed. getStats() is nullptr unless this was turned on.
+    void setStatsOnly(bool tf);
+    const mptsStats *getStats() const { return m_pStats.get(); }
+
+    // Only parse and print a PAT or PMT section when it differs from the last one of its table.
+    // getTables() is nullptr unless this was turned on.
+    void setSkipRepeatedTables(bool tf);
+    const mptsTableCache *getTables() const { return m_pTables.get(); }
+
+    // Also describe packets, PES packets, tables and frames as records, nullptr stops that.
+    // The writer must last as long as the parser.
+    void setRecordWriter(mptsRecordWriter *pRecords) { m_pRecords = pRecords; }
+
+    // "MPEG-2 Video" and the like
+    static const char *getStreamTypeName(uint8_t streamType);
+
+    // The buffers video frames are copied into, for their statistics
+    const mptsBufferPool &getBufferPool() const { return m_bufferPool; }
+
+    void printFrameInfo(mptsVideoStream &video);
     void printElementDescriptors(const program_map_table& pmt);
 
     bool setTerse(bool tf);
@@ -432,6 +525,27 @@ public:
     bool setAnalyzeElementaryStream(bool tf);
     bool getAnalyzeElementaryStream();
 
+    // Start from the program tables another parser has already read,
+    // for parsing from the middle of a file
+    void copyProgramInfo(const mptsParser &other);
+    bool hasProgramInfo() const;
+    bool isVideoPid(uint16_t pid) const;
+
+    // The programs of the PAT, in the order it lists them
+    const std::vector<mptsProgram> &getPrograms() const { return m_programs; }
+
+    // Number of video frames printed so far, over all video PIDs
+    unsigned int getFrameCount() const { return m_frameCount; }
+
+    // Sections on the PAT and PMT PIDs that were not a current PAT or PMT, and were skipped
+    uint64_t getSkippedSectionCount() const { return m_skippedSections; }
+
+    // For parsing part of a file. Packets of a frame that began before the part are
+    // skipped, and finishFrames() runs on past the end of the part to complete the
+    // frames still open, parsing nothing else. It returns false once none is open.
+    void setSkipPartialFrames(bool tf) { m_bSkipPartialFrames = tf; }
+    bool finishFrames(const uint8_t *data, size_t count, unsigned int stride);
+
     void flush();
 
 private:
@@ -442,30 +556,53 @@ private:
         util::printfXml(indentLevel, args...);
     }
 
+    template<unsigned int stride>
+    int16_t processPacketRun(const uint8_t *data, size_t count, size_t packetNum);
+    int16_t processPacket(uint8_t *packet, size_t packetNum, size_t index);
+
     void inline incPtr(uint8_t *&p, size_t bytes);
-    void initStreamTypes(std::map <uint16_t, const char *> &streamMap);
+    static void initStreamTypes(const char *streamMap[256]);
+    void copyStreamTypes(mptsStats &stats) const;
 
     uint64_t readTimeStamp(uint8_t *&p);
     float convertTimeStamp(uint64_t timeStamp);
-
-    uint8_t *m_pVideoData;
-    size_t &m_filePosition;
+    size_t getFrameHeaderSize(const mptsPayload &payload, eMptsStreamType streamType);
+    mptsProgram &addProgram(uint16_t programNumber, uint16_t pmtPid);
+    void setPcrPid(uint16_t programNumber, uint16_t pcrPid);
+    mptsVideoStream &getVideoStream(uint16_t pid);
+    bool hasOpenFrames() const;
+    void recordPes(uint16_t pid, uint8_t *p, const uint8_t *pEnd, int64_t position, size_t packetNum);
+    void recordFrame(const mpts_frame *pFrame, unsigned int frameNumber, char type, bool bGopStart, const PES_packet &pes_packet);
+
+    int64_t &m_filePosition;
     unsigned int m_packetSize;
-    int16_t m_programNumber;
-    int16_t m_programMapPid;
     int16_t m_networkPid; // TODO: this is stored but not used
     int16_t m_scte35Pid; // TODO: this is stored but not used
-    size_t m_videoDataSize;
-    size_t m_videoBufferSize;
+    int32_t m_lastPid;
+    unsigned int m_videoFrameNumber;
+    unsigned int m_frameCount;
+    uint64_t m_skippedSections;
+
+    std::vector<mptsPidInfo> m_pids; // Indexed by PID, ePidCount entries
+    std::vector<mptsProgram> m_programs;
+    bool m_bProgramInfo;
 
-    std::map <uint16_t, const char *> m_pidToNameMap; // ID, name
-    std::map <uint16_t, eMptsStreamType> m_pidToTypeMap; // PID, stream type
+    std::bitset<ePidCount> m_pidFilter;
+    bool m_bPidFilter;
 
     bool m_bTerse;
     bool m_bAnalyzeElementaryStream;
+    bool m_bSkipPartialFrames;
 
-    mpts_frame m_videoFrame;
     mpts_frame m_audioFrame;
 
-    std::shared_ptr<baseParser> m_parser;
+    mptsHeaders m_headers;
+    std::unique_ptr<mptsContinuity> m_pContinuity;
+    std::unique_ptr<mptsPcr> m_pPcr;
+    std::unique_ptr<mptsStats> m_pStats;
+    std::unique_ptr<mptsTableCache> m_pTables;
+    mptsBufferPool m_bufferPool;
+    uint8_t *m_pPinnedStart;
+    uint8_t *m_pPinnedEnd;
+    mptsRecordWriter *m_pRecords;
 };
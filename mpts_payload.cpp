@@ -0,0 +1,222 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "mpts_payload.h"
+
+mptsBufferPool::mptsBufferPool()
+    : m_highWaterMark(0)
+    , m_allocationCount(0)
+{
+}
+
+mptsBufferPool::~mptsBufferPool()
+{
+    for(auto &[pid, b] : m_buffers)
+        free(b.p);
+}
+
+mptsBufferPool::buffer *mptsBufferPool::get(uint16_t pid)
+{
+    auto it = m_buffers.find(pid);
+
+    if(m_buffers.end() == it)
+        it = m_buffers.emplace(pid, buffer{ nullptr, 0 }).first;
+
+    return &it->second;
+}
+
+void mptsBufferPool::grow(buffer &b, size_t used, size_t size)
+{
+    if(size > m_highWaterMark)
+        m_highWaterMark = size;
+
+    if(size <= b.capacity)
+        return;
+
+    size_t capacity = b.capacity ? b.capacity : POOL_MIN_BUFFER_SIZE;
+
+    while(capacity < size)
+        capacity *= 2;
+
+    // Nothing needs keeping at the start of a frame, which saves realloc copying it
+    if(0 == used)
+    {
+        free(b.p);
+        b.p = (uint8_t *) malloc(capacity);
+    }
+    else
+    {
+        b.p = (uint8_t *) realloc((void *) b.p, capacity);
+    }
+
+    b.capacity = capacity;
+    m_allocationCount++;
+}
+
+size_t mptsBufferPool::getRetainedBytes() const
+{
+    size_t bytes = 0;
+
+    for(const auto &[pid, b] : m_buffers)
+        bytes += b.capacity;
+
+    return bytes;
+}
+
+mptsPayload::mptsPayload(mptsBufferPool &pool, uint16_t pid)
+    : m_pool(pool)
+    , m_pCopies(pool.get(pid))
+    , m_copySize(0)
+    , m_size(0)
+{
+}
+
+void mptsPayload::setPid(uint16_t pid)
+{
+    if(0 == m_size)
+        m_pCopies = m_pool.get(pid);
+}
+
+void mptsPayload::push(uint8_t *p, size_t size)
+{
+    if(0 == size)
+        return;
+
+    if(m_segments.size() && m_segments.back().p && m_segments.back().p + m_segments.back().size == p)
+        m_segments.back().size += size;
+    else
+        m_segments.push_back({ p, 0, size });
+
+    m_size += size;
+}
+
+void mptsPayload::pushCopy(const uint8_t *p, size_t size)
+{
+    if(0 == size)
+        return;
+
+    size_t offset = m_copySize;
+
+    m_copySize += size;
+    m_pool.grow(*m_pCopies, offset, m_copySize + PAYLOAD_PADDING);
+    std::memcpy(m_pCopies->p + offset, p, size);
+    std::memset(m_pCopies->p + m_copySize, 0, PAYLOAD_PADDING);
+
+    if(m_segments.size() && nullptr == m_segments.back().p && m_segments.back().offset + m_segments.back().size == offset)
+        m_segments.back().size += size;
+    else
+        m_segments.push_back({ nullptr, offset, size });
+
+    m_size += size;
+}
+
+void mptsPayload::clear()
+{
+    m_segments.clear();
+    m_copySize = 0;
+    m_size = 0;
+}
+
+uint8_t mptsPayload::byteAt(size_t offset) const
+{
+    for(const segment &s : m_segments)
+    {
+        if(offset < s.size)
+            return data(s)[offset];
+
+        offset -= s.size;
+    }
+
+    return 0;
+}
+
+size_t mptsPayload::findStartCode(size_t from, uint8_t &code) const
+{
+    uint32_t window = 0xFFFFFFFF;
+    size_t segmentStart = 0;
+
+    for(const segment &s : m_segments)
+    {
+        if(segmentStart + s.size <= from)
+        {
+            segmentStart += s.size;
+            continue;
+        }
+
+        const uint8_t *p = data(s);
+
+        for(size_t i = from > segmentStart ? from - segmentStart : 0; i < s.size; i++)
+        {
+            window = (window << 8) | p[i];
+
+            if(0x00000100 == (window & 0xFFFFFF00))
+            {
+                code = p[i];
+                return segmentStart + i - 3;
+            }
+        }
+
+        segmentStart += s.size;
+    }
+
+    return m_size;
+}
+
+uint8_t *mptsPayload::contiguous(size_t bytes)
+{
+    if(bytes > m_size)
+        bytes = m_size;
+
+    // Copies are padded, referenced pieces need the padding to be in the piece
+    if(m_segments.size())
+    {
+        const segment &s = m_segments[0];
+
+        if(nullptr == s.p ? bytes <= s.size : bytes + PAYLOAD_PADDING <= s.size)
+            return (uint8_t *) data(s);
+    }
+
+    m_gather.resize(bytes + PAYLOAD_PADDING);
+
+    size_t copied = 0;
+
+    for(size_t i = 0; copied < bytes; i++)
+    {
+        size_t n = m_segments[i].size;
+
+        if(n > bytes - copied)
+            n = bytes - copied;
+
+        std::memcpy(m_gather.data() + copied, data(m_segments[i]), n);
+        copied += n;
+    }
+
+    std::memset(m_gather.data() + bytes, 0, PAYLOAD_PADDING);
+
+    return m_gather.data();
+}
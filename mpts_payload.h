@@ -0,0 +1,119 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <map>
+
+// Zero bytes kept after the contiguous copy, the codec parsers may look a few bytes past the end
+#define PAYLOAD_PADDING 8
+
+// Smallest buffer the pool allocates, buffers double in size from here until the frame fits
+#define POOL_MIN_BUFFER_SIZE (64 * 1024)
+
+// The buffers video payloads are copied into. They are kept from one frame to the next
+// instead of being freed, one per PID, so each settles at the size its PID's frames need.
+class mptsBufferPool
+{
+public:
+    struct buffer
+    {
+        uint8_t *p;
+        size_t capacity;
+    };
+
+    mptsBufferPool();
+    ~mptsBufferPool();
+
+    // The buffer of pid, empty the first time
+    buffer *get(uint16_t pid);
+
+    // Make room for at least size bytes in b, keeping its first used bytes
+    void grow(buffer &b, size_t used, size_t size);
+
+    // The most bytes any frame needed, how often a buffer was allocated or grown, and the memory held
+    size_t getHighWaterMark() const { return m_highWaterMark; }
+    size_t getAllocationCount() const { return m_allocationCount; }
+    size_t getRetainedBytes() const;
+
+private:
+    std::map<uint16_t, buffer> m_buffers; // PID, buffer
+    size_t m_highWaterMark;
+    size_t m_allocationCount;
+};
+
+// The payload of a PES packet as a list of the pieces the transport stream packets carried.
+//
+// Pieces in memory that stays valid until the frame is parsed, like a memory mapped file,
+// are referenced where they are. Anything else is copied, and copies that follow each other
+// are kept as one piece.
+class mptsPayload
+{
+public:
+    mptsPayload(mptsBufferPool &pool, uint16_t pid = 0x1FFF);
+
+    // Copy into the pool buffer of pid from now on. Ignored unless the payload is empty.
+    void setPid(uint16_t pid);
+
+    // Reference size bytes at p, p must stay valid until clear()
+    void push(uint8_t *p, size_t size);
+
+    // Copy size bytes from p
+    void pushCopy(const uint8_t *p, size_t size);
+
+    void clear();
+
+    size_t size() const { return m_size; }
+    size_t getSegmentCount() const { return m_segments.size(); }
+
+    uint8_t byteAt(size_t offset) const;
+
+    // Offset of the first start code (0x000001xx) that begins at or after from, or size() when there is none.
+    // The start code may be split between pieces, code is set to the byte after the prefix.
+    size_t findStartCode(size_t from, uint8_t &code) const;
+
+    // The first bytes bytes as one run of memory. Only copied when they are in more than one piece.
+    uint8_t *contiguous(size_t bytes);
+
+private:
+    struct segment
+    {
+        uint8_t *p;     // nullptr when the bytes are in m_copies
+        size_t offset;  // Where the bytes start in m_copies
+        size_t size;
+    };
+
+    const uint8_t *data(const segment &s) const { return s.p ? s.p : m_pCopies->p + s.offset; }
+
+    mptsBufferPool &m_pool;
+    mptsBufferPool::buffer *m_pCopies; // Always followed by PAYLOAD_PADDING zero bytes
+    size_t m_copySize;
+    std::vector<segment> m_segments;
+    std::vector<uint8_t> m_gather;
+    size_t m_size;
+};
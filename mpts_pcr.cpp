@@ -0,0 +1,566 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#include <cstdint>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include "mpts_pcr.h"
+#include "mpts_checkpoint.h"
+#include "mpts_sync.h"
+#include "util.h"
+
+// The PCR base is 33 bits
+#define PCR_WRAP ((1ULL << 33) * 300)
+
+#define PCR_WINDOW_TICKS ((uint64_t) (PCR_WINDOW_SECONDS * PCR_CLOCK))
+#define PCR_MAX_STEP_TICKS ((uint64_t) (PCR_MAX_STEP * PCR_CLOCK))
+
+mptsPcr::mptsPcr(bool bJoined)
+    : m_stride(TS_PACKET_SIZE)
+    , m_pids(0x2000)
+    , m_pcrPids(0x2000)
+    , m_bPcrPids(false)
+    , m_bJoined(bJoined)
+    , m_windowsSize(0)
+{
+    for(pidState &state : m_pids)
+        initState(state);
+}
+
+void mptsPcr::initState(pidState &state)
+{
+    state.count = 0;
+    state.discontinuities = 0;
+    state.discontinuityErrors = 0;
+    state.intervals = 0;
+    state.intervalErrors = 0;
+    state.minInterval = UINT64_MAX;
+    state.maxInterval = 0;
+    state.totalInterval = 0;
+    state.totalBytes = 0;
+    state.minBitrate = DBL_MAX;
+    state.maxBitrate = 0.;
+    state.jitterCount = 0;
+    state.minJitter = DBL_MAX;
+    state.maxJitter = -DBL_MAX;
+    state.sumSquares = 0.;
+    state.bLast = false;
+    state.last = { 0, 0, false };
+    state.wraps = 0;
+    state.windowOffset = 0;
+    state.windowTicks = 0;
+    state.windowLength = 0;
+    state.fit = { 0., 0., 0., 0., 0. };
+    state.lastFit = state.fit;
+    state.held.clear();
+    state.heldWindow = 0;
+}
+
+void mptsPcr::addPid(uint16_t pid)
+{
+    m_pcrPids[pid & 0x1FFF] = true;
+    m_bPcrPids = true;
+}
+
+void mptsPcr::check(const mptsHeaders &headers, const uint8_t *packets, unsigned int stride, int64_t fileOffset)
+{
+    m_stride = stride;
+
+    for(size_t i = 0; i < headers.size(); i++, packets += stride, fileOffset += stride)
+    {
+        // Table 2-6, the PCR is the first field after the adaptation field flags
+        if(0 == (headers.adaptationFieldControl[i] & 0x02) || packets[4] < 7 || 0 == (packets[5] & 0x10))
+            continue;
+
+        const uint8_t *p = packets + 6;
+
+        uint64_t base = ((uint64_t) util::read4Bytes((uint8_t *) p) << 1) | (p[4] >> 7);
+        uint64_t extension = ((p[4] & 0x01) << 8) | p[5];
+
+        pcrSample sample = { fileOffset, base * 300 + extension, 0 != (packets[5] & 0x80) };
+        uint16_t pid = headers.pid[i];
+
+        if(m_bJoined)
+            hold(m_pids[pid], pid, sample);
+        else
+            add(m_pids[pid], pid, sample);
+    }
+}
+
+// The ticks from last to sample, false when sample starts a new line.
+// Going back is only the PCR going round when it was about to.
+bool mptsPcr::step(const pcrSample &last, const pcrSample &sample, uint64_t &ticks, bool &bWrap)
+{
+    bWrap = sample.pcr < last.pcr;
+    ticks = bWrap ? sample.pcr + PCR_WRAP - last.pcr : sample.pcr - last.pcr;
+
+    if(bWrap && last.pcr + PCR_MAX_STEP_TICKS < PCR_WRAP)
+        return false;
+
+    return false == sample.bDiscontinuity && ticks <= PCR_MAX_STEP_TICKS;
+}
+
+bool mptsPcr::isWindowStart(const pcrSample &last, const pcrSample &sample)
+{
+    uint64_t ticks;
+    bool bWrap;
+
+    return false == step(last, sample, ticks, bWrap) || bWrap || last.pcr / PCR_WINDOW_TICKS != sample.pcr / PCR_WINDOW_TICKS;
+}
+
+void mptsPcr::hold(pidState &state, uint16_t pid, const pcrSample &sample)
+{
+    if(state.bLast)
+    {
+        add(state, pid, sample);
+        return;
+    }
+
+    bool bWindowStart = state.held.size() && isWindowStart(state.held.back(), sample);
+
+    if(bWindowStart && 0 == state.heldWindow)
+        state.heldWindow = state.held.size();
+    else if(bWindowStart || state.held.size() >= PCR_MAX_HELD)
+    {
+        // append() runs the held PCRs on from the part before all over again,
+        // here only the first window that began in this part counts, and only as far as where it got to
+        pidState first;
+
+        initState(first);
+
+        for(size_t i = state.heldWindow; i < state.held.size(); i++)
+            add(first, pid, state.held[i]);
+
+        state.bLast = true;
+        state.last = first.last;
+        state.windowOffset = first.windowOffset;
+        state.windowTicks = first.windowTicks;
+        state.windowLength = first.windowLength;
+        state.fit = first.fit;
+
+        add(state, pid, sample);
+        return;
+    }
+
+    state.held.push_back(sample);
+}
+
+void mptsPcr::add(pidState &state, uint16_t pid, const pcrSample &sample)
+{
+    uint64_t ticks = 0;
+    bool bWrap = false;
+
+    state.count++;
+
+    if(false == state.bLast)
+        startLine(state, sample);
+    else if(false == step(state.last, sample, ticks, bWrap))
+    {
+        if(sample.bDiscontinuity)
+            state.discontinuities++;
+        else
+            state.discontinuityErrors++;
+
+        closeWindow(state, pid, state.last.fileOffset);
+        startLine(state, sample);
+    }
+    else
+    {
+        int64_t bytes = sample.fileOffset - state.last.fileOffset;
+
+        if(ticks)
+        {
+            double bytesPerSecond = bytes / (ticks / PCR_CLOCK);
+
+            state.minInterval = std::min(state.minInterval, ticks);
+            state.maxInterval = std::max(state.maxInterval, ticks);
+            state.minBitrate = std::min(state.minBitrate, bytesPerSecond);
+            state.maxBitrate = std::max(state.maxBitrate, bytesPerSecond);
+
+            if(ticks > PCR_MAX_INTERVAL * PCR_CLOCK)
+                state.intervalErrors++;
+
+            state.intervals++;
+        }
+
+        state.totalInterval += ticks;
+        state.totalBytes += bytes;
+        state.wraps += bWrap;
+        state.windowLength += ticks;
+
+        // The fit of the window that closes goes on from the start of the next one
+        if(bWrap || state.last.pcr / PCR_WINDOW_TICKS != sample.pcr / PCR_WINDOW_TICKS)
+        {
+            closeWindow(state, pid, sample.fileOffset);
+
+            state.lastFit = state.fit;
+            state.lastFit.meanBytes -= (double) (sample.fileOffset - state.windowOffset);
+            state.lastFit.meanTicks -= (double) state.windowLength;
+            state.windowOffset = sample.fileOffset;
+            state.windowTicks = sample.pcr + state.wraps * PCR_WRAP;
+            state.windowLength = 0;
+            state.fit = { 0., 0., 0., 0., 0. };
+        }
+    }
+
+    double x = (double) (sample.fileOffset - state.windowOffset);
+    double y = (double) state.windowLength;
+    lineFit &fit = state.fit;
+
+    if(state.lastFit.count >= 2. && state.lastFit.sxx > 0.)
+    {
+        double predicted = state.lastFit.meanTicks + (x - state.lastFit.meanBytes) * state.lastFit.sxy / state.lastFit.sxx;
+        double jitter = (y - predicted) / PCR_CLOCK * 1e9;
+
+        state.minJitter = std::min(state.minJitter, jitter);
+        state.maxJitter = std::max(state.maxJitter, jitter);
+        state.sumSquares += jitter * jitter;
+        state.jitterCount++;
+    }
+
+    // Welford's running means and sums of the products of the deviations
+    double dx = x - fit.meanBytes;
+
+    fit.count += 1.;
+    fit.meanBytes += dx / fit.count;
+    fit.meanTicks += (y - fit.meanTicks) / fit.count;
+    fit.sxx += dx * (x - fit.meanBytes);
+    fit.sxy += dx * (y - fit.meanTicks);
+
+    state.bLast = true;
+    state.last = sample;
+}
+
+void mptsPcr::startLine(pidState &state, const pcrSample &sample)
+{
+    state.windowOffset = sample.fileOffset;
+    state.windowTicks = sample.pcr + state.wraps * PCR_WRAP;
+    state.windowLength = 0;
+    state.fit = { 0., 0., 0., 0., 0. };
+    state.lastFit = state.fit;
+}
+
+void mptsPcr::closeWindow(pidState &state, uint16_t pid, int64_t endOffset)
+{
+    if(state.windowLength)
+        writeWindow({ state.windowOffset, state.windowTicks, endOffset - state.windowOffset, state.windowLength, pid });
+}
+
+void mptsPcr::writeWindow(const window &w)
+{
+    if(nullptr == m_pWindows)
+    {
+        FILE *pFile = tmpfile();
+
+        if(nullptr == pFile)
+        {
+            fprintf(stderr, "Can't create a temporary file for the PCR windows\n");
+            return;
+        }
+
+        m_pWindows.reset(pFile, fclose);
+    }
+
+    fwrite(&w, sizeof(w), 1, m_pWindows.get());
+}
+
+void mptsPcr::append(const mptsPcr &next)
+{
+    // How often the PCR of each PID went round before the PCRs next added itself
+    std::vector<uint64_t> wraps(m_pids.size());
+    bool bAny = false;
+
+    for(size_t pid = 0; pid < m_pids.size(); pid++)
+    {
+        pidState &state = m_pids[pid];
+        const pidState &nextState = next.m_pids[pid];
+
+        if(nextState.held.size() || nextState.bLast)
+            bAny = true;
+
+        for(const pcrSample &sample : nextState.held)
+            add(state, (uint16_t) pid, sample);
+
+        wraps[pid] = state.wraps;
+
+        if(false == nextState.bLast)
+            continue;
+
+        state.count += nextState.count;
+        state.discontinuities += nextState.discontinuities;
+        state.discontinuityErrors += nextState.discontinuityErrors;
+        state.intervals += nextState.intervals;
+        state.intervalErrors += nextState.intervalErrors;
+        state.minInterval = std::min(state.minInterval, nextState.minInterval);
+        state.maxInterval = std::max(state.maxInterval, nextState.maxInterval);
+        state.totalInterval += nextState.totalInterval;
+        state.totalBytes += nextState.totalBytes;
+        state.minBitrate = std::min(state.minBitrate, nextState.minBitrate);
+        state.maxBitrate = std::max(state.maxBitrate, nextState.maxBitrate);
+        state.jitterCount += nextState.jitterCount;
+        state.minJitter = std::min(state.minJitter, nextState.minJitter);
+        state.maxJitter = std::max(state.maxJitter, nextState.maxJitter);
+        state.sumSquares += nextState.sumSquares;
+
+        state.bLast = true;
+        state.last = nextState.last;
+        state.wraps += nextState.wraps;
+        state.windowOffset = nextState.windowOffset;
+        state.windowTicks = nextState.windowTicks + wraps[pid] * PCR_WRAP;
+        state.windowLength = nextState.windowLength;
+        state.fit = nextState.fit;
+        state.lastFit = nextState.lastFit;
+    }
+
+    // The windows next closed come after the ones that closed running on its held PCRs
+    if(next.m_pWindows)
+    {
+        FILE *pFile = next.m_pWindows.get();
+        window w;
+
+        rewind(pFile);
+
+        while(1 == fread(&w, sizeof(w), 1, pFile))
+        {
+            w.ticks += wraps[w.pid] * PCR_WRAP;
+            writeWindow(w);
+        }
+
+        fseek(pFile, 0, SEEK_END);
+    }
+
+    if(bAny)
+        m_stride = next.m_stride;
+
+    for(size_t pid = 0; pid < m_pcrPids.size(); pid++)
+    {
+        if(next.m_pcrPids[pid])
+            m_pcrPids[pid] = true;
+    }
+
+    m_bPcrPids |= next.m_bPcrPids;
+}
+
+void mptsPcr::save(mptsCheckpoint &checkpoint) const
+{
+    uint64_t pcrPids = std::count(m_pcrPids.begin(), m_pcrPids.end(), true);
+    uint64_t pids = 0;
+
+    checkpoint.put(m_stride);
+    checkpoint.put(m_bPcrPids);
+    checkpoint.put(pcrPids);
+
+    for(size_t pid = 0; pid < m_pcrPids.size(); pid++)
+    {
+        if(m_pcrPids[pid])
+            checkpoint.put(pid);
+    }
+
+    for(const pidState &state : m_pids)
+        pids += state.bLast;
+
+    checkpoint.put(pids);
+
+    // Nothing is held back by the parts that begin the stream, the only ones saved
+    for(size_t pid = 0; pid < m_pids.size(); pid++)
+    {
+        const pidState &state = m_pids[pid];
+
+        if(false == state.bLast)
+            continue;
+
+        checkpoint.put(pid);
+        checkpoint.put(state.count);
+        checkpoint.put(state.discontinuities);
+        checkpoint.put(state.discontinuityErrors);
+        checkpoint.put(state.intervals);
+        checkpoint.put(state.intervalErrors);
+        checkpoint.put(state.minInterval);
+        checkpoint.put(state.maxInterval);
+        checkpoint.put(state.totalInterval);
+        checkpoint.put((uint64_t) state.totalBytes);
+        checkpoint.putDouble(state.minBitrate);
+        checkpoint.putDouble(state.maxBitrate);
+        checkpoint.put(state.jitterCount);
+        checkpoint.putDouble(state.minJitter);
+        checkpoint.putDouble(state.maxJitter);
+        checkpoint.putDouble(state.sumSquares);
+        checkpoint.put((uint64_t) state.last.fileOffset);
+        checkpoint.put(state.last.pcr);
+        checkpoint.put(state.last.bDiscontinuity);
+        checkpoint.put(state.wraps);
+        checkpoint.put((uint64_t) state.windowOffset);
+        checkpoint.put(state.windowTicks);
+        checkpoint.put(state.windowLength);
+
+        for(const lineFit *pFit : { &state.fit, &state.lastFit })
+        {
+            checkpoint.putDouble(pFit->count);
+            checkpoint.putDouble(pFit->meanBytes);
+            checkpoint.putDouble(pFit->meanTicks);
+            checkpoint.putDouble(pFit->sxx);
+            checkpoint.putDouble(pFit->sxy);
+        }
+    }
+
+    // The windows closed so far are in the file of keepWindows()
+    checkpoint.put((uint64_t) (m_pWindows ? mptsCheckpoint::tell(m_pWindows.get()) : 0));
+}
+
+void mptsPcr::load(mptsCheckpoint &checkpoint)
+{
+    m_stride = (unsigned int) checkpoint.get();
+    m_bPcrPids = 0 != checkpoint.get();
+
+    uint64_t pcrPids = checkpoint.get();
+
+    for(uint64_t i = 0; i < pcrPids && checkpoint.isGood(); i++)
+        m_pcrPids[checkpoint.get() & 0x1FFF] = true;
+
+    uint64_t pids = checkpoint.get();
+
+    for(uint64_t i = 0; i < pids && checkpoint.isGood(); i++)
+    {
+        pidState &state = m_pids[checkpoint.get() & 0x1FFF];
+
+        state.count = checkpoint.get();
+        state.discontinuities = checkpoint.get();
+        state.discontinuityErrors = checkpoint.get();
+        state.intervals = checkpoint.get();
+        state.intervalErrors = checkpoint.get();
+        state.minInterval = checkpoint.get();
+        state.maxInterval = checkpoint.get();
+        state.totalInterval = checkpoint.get();
+        state.totalBytes = (int64_t) checkpoint.get();
+        state.minBitrate = checkpoint.getDouble();
+        state.maxBitrate = checkpoint.getDouble();
+        state.jitterCount = checkpoint.get();
+        state.minJitter = checkpoint.getDouble();
+        state.maxJitter = checkpoint.getDouble();
+        state.sumSquares = checkpoint.getDouble();
+        state.bLast = true;
+        state.last.fileOffset = (int64_t) checkpoint.get();
+        state.last.pcr = checkpoint.get();
+        state.last.bDiscontinuity = 0 != checkpoint.get();
+        state.wraps = checkpoint.get();
+        state.windowOffset = (int64_t) checkpoint.get();
+        state.windowTicks = checkpoint.get();
+        state.windowLength = checkpoint.get();
+
+        for(lineFit *pFit : { &state.fit, &state.lastFit })
+        {
+            pFit->count = checkpoint.getDouble();
+            pFit->meanBytes = checkpoint.getDouble();
+            pFit->meanTicks = checkpoint.getDouble();
+            pFit->sxx = checkpoint.getDouble();
+            pFit->sxy = checkpoint.getDouble();
+        }
+    }
+
+    m_windowsSize = (int64_t) checkpoint.get();
+}
+
+bool mptsPcr::keepWindows(const char *fileName, bool bResume)
+{
+    FILE *pFile = fopen(fileName, bResume ? "r+b" : "w+b");
+
+    if(nullptr == pFile)
+        return false;
+
+    m_pWindows.reset(pFile, fclose);
+
+    return false == bResume || mptsCheckpoint::truncate(pFile, m_windowsSize);
+}
+
+bool mptsPcr::sync() const
+{
+    return nullptr == m_pWindows || mptsCheckpoint::sync(m_pWindows.get());
+}
+
+void mptsPcr::print() const
+{
+    for(size_t pid = 0; pid < m_pids.size(); pid++)
+    {
+        if(m_pids[pid].count && (false == m_bPcrPids || m_pcrPids[pid]))
+            printPid((uint16_t) pid);
+    }
+}
+
+void mptsPcr::printPid(uint16_t pid) const
+{
+    const pidState &state = m_pids[pid];
+
+    // Bits of 188 byte packets a second, from bytes on the disk
+    const double packetBits = 8. * TS_PACKET_SIZE / m_stride;
+
+    auto printWindow = [packetBits](const window &w)
+    {
+        double seconds = w.length / PCR_CLOCK;
+
+        util::printfXml(2, "<window start=\"%lld\" time=\"%f\" seconds=\"%f\" bitrate=\"%.0f\"/>\n",
+            (long long) w.fileOffset, w.ticks / PCR_CLOCK, seconds, w.bytes * packetBits / seconds);
+    };
+
+    double seconds = state.totalInterval / PCR_CLOCK;
+
+    util::printfXml(1, "<pcr pid=\"0x%x\" count=\"%llu\" bitrate=\"%.0f\">\n", pid, (unsigned long long) state.count, seconds > 0. ? state.totalBytes * packetBits / seconds : 0.);
+
+    if(state.intervals)
+    {
+        util::printfXml(2, "<interval min_ms=\"%.3f\" max_ms=\"%.3f\" average_ms=\"%.3f\" over_40ms=\"%llu\"/>\n",
+            state.minInterval / PCR_CLOCK * 1000., state.maxInterval / PCR_CLOCK * 1000., seconds * 1000. / state.intervals,
+            (unsigned long long) state.intervalErrors);
+        util::printfXml(2, "<instantaneous_bitrate min=\"%.0f\" max=\"%.0f\"/>\n", state.minBitrate * packetBits, state.maxBitrate * packetBits);
+    }
+
+    if(state.jitterCount)
+        util::printfXml(2, "<jitter min_ns=\"%.0f\" max_ns=\"%.0f\" rms_ns=\"%.0f\"/>\n", state.minJitter, state.maxJitter, sqrt(state.sumSquares / state.jitterCount));
+
+    if(state.discontinuities || state.discontinuityErrors)
+        util::printfXml(2, "<discontinuity indicated=\"%llu\" errors=\"%llu\"/>\n", (unsigned long long) state.discontinuities, (unsigned long long) state.discontinuityErrors);
+
+    // The bitrate over each window of PCR time, and the one still open
+    if(m_pWindows)
+    {
+        FILE *pFile = m_pWindows.get();
+        window w;
+
+        rewind(pFile);
+
+        while(1 == fread(&w, sizeof(w), 1, pFile))
+        {
+            if(w.pid == pid)
+                printWindow(w);
+        }
+
+        fseek(pFile, 0, SEEK_END);
+    }
+
+    if(state.windowLength)
+        printWindow({ state.windowOffset, state.windowTicks, state.last.fileOffset - state.windowOffset, state.windowLength, pid });
+
+    util::printfXml(1, "</pcr>\n");
+}
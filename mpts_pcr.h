@@ -0,0 +1,178 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "mpts_headers.h"
+
+class mptsCheckpoint;
+
+// The PCR runs at 27MHz
+#define PCR_CLOCK 27000000.
+
+// Length of each entry of the bitrate time series, in whole seconds of PCR time
+#define PCR_WINDOW_SECONDS 1
+
+// TR 101 290 wants a PCR at least every 40ms
+#define PCR_MAX_INTERVAL 0.04
+
+// and a step from one PCR to the next of no more than 100ms, nor backwards, without a discontinuity_indicator
+#define PCR_MAX_STEP 0.1
+
+// Most PCRs of a PID a joined part of the stream holds back for append(), only a PCR that hardly moves needs as many
+#define PCR_MAX_HELD 65536
+
+struct pcrSample
+{
+    int64_t fileOffset; // Of the stride holding the PCR
+    uint64_t pcr;       // program_clock_reference_base * 300 + program_clock_reference_extension
+    bool bDiscontinuity;
+};
+
+// Reads the PCRs of each program's pcr_pid, and works out the transport bitrate, the PCR intervals and the PCR jitter.
+//
+// Bitrates count 188 byte packets, whatever the stride on disk. The PCRs of a PID make up lines, each one
+// ending where a discontinuity_indicator is set or the PCR steps back or more than PCR_MAX_STEP forward,
+// which is also counted as an error. The bitrate is the bytes over the PCR time of all the lines.
+// Each line is cut into windows at the first PCR of every PCR_WINDOW_SECONDS of the clock, and the jitter
+// of each PCR is how far it is from the straight line fitted through the PCRs of the window before,
+// which is what a constant bitrate muxer should produce.
+//
+// Only running totals and the open window of each PID are kept, the windows go to a temporary file as
+// they close. A part of the stream that append() adds on to the part before is parsed joined, holding
+// back the PCRs of each PID until two windows began in it, as they depend on what came before. append()
+// runs them on from the part before, so the result is the same as from reading the stream in one go.
+class mptsPcr
+{
+public:
+    explicit mptsPcr(bool bJoined = false);
+
+    // A pcr_pid from a PMT. The PCRs of every PID are checked, only these are reported once there are any.
+    void addPid(uint16_t pid);
+
+    // Look for PCRs in a batch of decoded headers, packets pointing at the first sync byte,
+    // stride bytes apart, and fileOffset being the position of the first packet's stride
+    void check(const mptsHeaders &headers, const uint8_t *packets, unsigned int stride, int64_t fileOffset);
+
+    // Add the PCRs of the part of the stream that comes straight after this one
+    void append(const mptsPcr &next);
+
+    // Save what append() needs to carry on from here, and load it back into a new object, see mpts_checkpoint.h.
+    // Only the totals and the open windows are in the checkpoint, with how far the file of keepWindows() had got.
+    void save(mptsCheckpoint &checkpoint) const;
+    void load(mptsCheckpoint &checkpoint);
+
+    // Keep the closed windows in fileName instead of a temporary file, before any window closed.
+    // bResume carries on from as much of the file as there was at the checkpoint load() read, false when it is shorter.
+    bool keepWindows(const char *fileName, bool bResume);
+
+    // Put the windows kept by keepWindows() on the disk, before a checkpoint points into them
+    bool sync() const;
+
+    // Write the summary and the bitrate of each window of each pcr_pid as xml.
+    // Without any pcr_pid every PID that carried a PCR is reported.
+    void print() const;
+
+private:
+    // Least squares sums of the ticks against the bytes from the start of a window
+    struct lineFit
+    {
+        double count;
+        double meanBytes;
+        double meanTicks;
+        double sxx;
+        double sxy;
+    };
+
+    struct window
+    {
+        int64_t fileOffset; // Of the PCR it starts with
+        uint64_t ticks;     // That PCR, counting the times the PCR went round
+        int64_t bytes;      // To the PCR that ends it, in strides
+        uint64_t length;    // In ticks
+        uint16_t pid;
+    };
+
+    struct pidState
+    {
+        uint64_t count;
+        uint64_t discontinuities;       // Lines begun by a discontinuity_indicator
+        uint64_t discontinuityErrors;   // and without one
+
+        // Between neighbouring PCRs of a line, in ticks and strides
+        uint64_t intervals;
+        uint64_t intervalErrors;
+        uint64_t minInterval;
+        uint64_t maxInterval;
+        uint64_t totalInterval;
+        int64_t totalBytes;
+        double minBitrate;
+        double maxBitrate;
+
+        uint64_t jitterCount;
+        double minJitter;   // In ns
+        double maxJitter;
+        double sumSquares;
+
+        bool bLast;         // last holds the PCR before
+        pcrSample last;
+        uint64_t wraps;     // Times the PCR went round
+
+        int64_t windowOffset;
+        uint64_t windowTicks;   // Of its first PCR, counting the times the PCR went round
+        uint64_t windowLength;  // Up to last
+        lineFit fit;            // Of the open window
+        lineFit lastFit;        // Of the window before, from the start of the open one, no count when there is none
+
+        // Joined, the PCRs up to the second window start, and where the first one is
+        std::vector<pcrSample> held;
+        size_t heldWindow;
+    };
+
+    static void initState(pidState &state);
+    static bool isWindowStart(const pcrSample &last, const pcrSample &sample);
+    static bool step(const pcrSample &last, const pcrSample &sample, uint64_t &ticks, bool &bWrap);
+    void hold(pidState &state, uint16_t pid, const pcrSample &sample);
+    void add(pidState &state, uint16_t pid, const pcrSample &sample);
+    void startLine(pidState &state, const pcrSample &sample);
+    void closeWindow(pidState &state, uint16_t pid, int64_t endOffset);
+    void writeWindow(const window &w);
+    void printPid(uint16_t pid) const;
+
+    unsigned int m_stride;
+    std::vector<pidState> m_pids;   // Indexed by PID
+    std::vector<bool> m_pcrPids;    // Indexed by PID
+    bool m_bPcrPids;
+    bool m_bJoined;
+
+    // The closed windows of every PID, shared by the copies of a chunk's parser
+    std::shared_ptr<FILE> m_pWindows;
+    int64_t m_windowsSize;  // At the checkpoint load() read
+};
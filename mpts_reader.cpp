@@ -0,0 +1,500 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#ifdef WINDOWS
+#include <windows.h>
+#include <sys/stat.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "mpts_reader.h"
+
+freadReader::freadReader()
+    : m_pFile(nullptr)
+    , m_pBuffer(nullptr)
+    , m_bufferSize(0)
+    , m_lookaheadPosition(0)
+{
+}
+
+freadReader::~freadReader()
+{
+    close();
+}
+
+// A file name of "-" reads from stdin, which may be a pipe
+bool freadReader::open(const char *fileName)
+{
+    if(0 == strcmp("-", fileName))
+    {
+#ifdef WINDOWS
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        m_pFile = stdin;
+    }
+    else
+        m_pFile = fopen(fileName, "rb");
+
+    if(nullptr == m_pFile)
+        return false;
+
+    // Determine the size of the file, unknown for pipes and devices.
+    // Never seek, the input may not support it.
+#ifdef WINDOWS
+    struct __stat64 stat64Buf;
+    if(0 == _fstat64(_fileno(m_pFile), &stat64Buf) && (stat64Buf.st_mode & _S_IFREG))
+        m_fileSize = stat64Buf.st_size;
+    else
+        m_fileSize = -1;
+#else
+    struct stat statBuf;
+    if(0 == fstat(fileno(m_pFile), &statBuf) && S_ISREG(statBuf.st_mode))
+        m_fileSize = statBuf.st_size;
+    else
+        m_fileSize = -1;
+#endif
+
+    return true;
+}
+
+void freadReader::close()
+{
+    if(m_pFile && stdin != m_pFile)
+        fclose(m_pFile);
+
+    m_pFile = nullptr;
+
+    delete [] m_pBuffer;
+    m_pBuffer = nullptr;
+    m_bufferSize = 0;
+
+    m_lookahead.clear();
+    m_lookaheadPosition = 0;
+}
+
+// Bytes peeked at are kept in a lookahead buffer and handed out again by the first reads
+size_t freadReader::peek(uint8_t *buffer, size_t bytes)
+{
+    if(m_lookahead.size() < bytes)
+    {
+        size_t have = m_lookahead.size();
+        m_lookahead.resize(bytes);
+        m_lookahead.resize(have + fread(m_lookahead.data() + have, 1, bytes - have, m_pFile));
+    }
+
+    if(bytes > m_lookahead.size())
+        bytes = m_lookahead.size();
+
+    std::memcpy(buffer, m_lookahead.data(), bytes);
+
+    return bytes;
+}
+
+// Fill buffer with up to bytes, draining the lookahead buffer first
+size_t freadReader::readBlock(uint8_t *buffer, size_t bytes)
+{
+    size_t fromLookahead = m_lookahead.size() - m_lookaheadPosition;
+
+    if(fromLookahead > bytes)
+        fromLookahead = bytes;
+
+    if(fromLookahead)
+    {
+        std::memcpy(buffer, m_lookahead.data() + m_lookaheadPosition, fromLookahead);
+        m_lookaheadPosition += fromLookahead;
+    }
+
+    return fromLookahead + fread(buffer + fromLookahead, 1, bytes - fromLookahead, m_pFile);
+}
+
+size_t freadReader::read(uint8_t *&p)
+{
+    if(m_bufferSize != m_blockSize)
+    {
+        delete [] m_pBuffer;
+        m_pBuffer = new uint8_t[m_blockSize];
+        m_bufferSize = m_blockSize;
+    }
+
+    p = m_pBuffer;
+
+    return readBlock(m_pBuffer, m_bufferSize);
+}
+
+// fread keeps returning 0 once it has seen the end of the file, until the end of file flag is cleared
+bool freadReader::resume()
+{
+    if(nullptr == m_pFile)
+        return false;
+
+    clearerr(m_pFile);
+
+    return true;
+}
+
+bool freadReader::seek(int64_t offset)
+{
+    if(-1 == m_fileSize)
+        return false;
+
+#ifdef WINDOWS
+    if(0 != _fseeki64(m_pFile, offset, SEEK_SET))
+        return false;
+#else
+    if(0 != fseeko(m_pFile, offset, SEEK_SET))
+        return false;
+#endif
+
+    // Anything peeked at is from the old position
+    m_lookahead.clear();
+    m_lookaheadPosition = 0;
+
+    return true;
+}
+
+asyncReader::asyncReader(size_t queueDepth)
+    : m_queueDepth(queueDepth < 2 ? 2 : queueDepth)
+    , m_fillIndex(0)
+    , m_readIndex(0)
+    , m_readyCount(0)
+    , m_bHolding(false)
+    , m_bEndOfFile(false)
+    , m_bStop(false)
+    , m_bStarted(false)
+{
+}
+
+asyncReader::~asyncReader()
+{
+    close();
+}
+
+void asyncReader::close()
+{
+    if(m_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bStop = true;
+        }
+
+        m_emptiedCondition.notify_one();
+        m_thread.join();
+    }
+
+    for(auto &block : m_blocks)
+        delete [] block.pData;
+
+    m_blocks.clear();
+
+    freadReader::close();
+}
+
+void asyncReader::readerThread()
+{
+    for(;;)
+    {
+        size_t fillIndex = 0;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            // Every block is either queued or being parsed, wait for the parser to hand one back
+            m_emptiedCondition.wait(lock, [this] { return m_bStop || m_readyCount + (m_bHolding ? 1 : 0) < m_queueDepth; });
+
+            if(m_bStop)
+                return;
+
+            fillIndex = m_fillIndex;
+        }
+
+        queuedBlock &block = m_blocks[fillIndex];
+        block.bytes = readBlock(block.pData, m_blockSize);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if(block.bytes)
+            {
+                m_fillIndex = (m_fillIndex + 1) % m_queueDepth;
+                m_readyCount++;
+            }
+
+            if(block.bytes < m_blockSize)
+                m_bEndOfFile = true;
+        }
+
+        m_filledCondition.notify_one();
+
+        if(block.bytes < m_blockSize)
+            return;
+    }
+}
+
+size_t asyncReader::read(uint8_t *&p)
+{
+    if(false == m_bStarted)
+    {
+        m_blocks.resize(m_queueDepth);
+
+        for(auto &block : m_blocks)
+        {
+            block.pData = new uint8_t[m_blockSize];
+            block.bytes = 0;
+        }
+
+        m_bStarted = true;
+        m_thread = std::thread(&asyncReader::readerThread, this);
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // The previous block has been parsed, give it back to the reader thread
+    if(m_bHolding)
+    {
+        m_bHolding = false;
+        m_readIndex = (m_readIndex + 1) % m_queueDepth;
+        m_emptiedCondition.notify_one();
+    }
+
+    m_filledCondition.wait(lock, [this] { return m_readyCount > 0 || m_bEndOfFile; });
+
+    if(0 == m_readyCount)
+        return 0;
+
+    m_readyCount--;
+    m_bHolding = true;
+
+    p = m_blocks[m_readIndex].pData;
+
+    return m_blocks[m_readIndex].bytes;
+}
+
+// The reader thread owns the file position once it is running
+bool asyncReader::seek(int64_t offset)
+{
+    if(m_bStarted)
+        return false;
+
+    return freadReader::seek(offset);
+}
+
+mmapReader::mmapReader()
+    : m_pData(nullptr)
+    , m_position(0)
+#ifdef WINDOWS
+    , m_hFile(INVALID_HANDLE_VALUE)
+    , m_hMapping(nullptr)
+#else
+    , m_fd(-1)
+#endif
+{
+}
+
+mmapReader::~mmapReader()
+{
+    close();
+}
+
+#ifdef WINDOWS
+
+bool mmapReader::open(const char *fileName)
+{
+    if(0 == strcmp("-", fileName))
+        return false;
+
+    m_hFile = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+    if(INVALID_HANDLE_VALUE == m_hFile)
+        return false;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(m_hFile, &size) || 0 == size.QuadPart || (uint64_t) size.QuadPart > SIZE_MAX)
+    {
+        close();
+        return false;
+    }
+
+    m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if(nullptr == m_hMapping)
+    {
+        close();
+        return false;
+    }
+
+    m_pData = (uint8_t *) MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+
+    if(nullptr == m_pData)
+    {
+        close();
+        return false;
+    }
+
+    m_fileSize = size.QuadPart;
+    m_position = 0;
+
+    return true;
+}
+
+void mmapReader::close()
+{
+    if(m_pData)
+        UnmapViewOfFile(m_pData);
+
+    if(m_hMapping)
+        CloseHandle(m_hMapping);
+
+    if(INVALID_HANDLE_VALUE != m_hFile)
+        CloseHandle(m_hFile);
+
+    m_pData = nullptr;
+    m_hMapping = nullptr;
+    m_hFile = INVALID_HANDLE_VALUE;
+}
+
+void mmapReader::adviseWillNeed(size_t position)
+{
+    // FILE_FLAG_SEQUENTIAL_SCAN already asks the cache manager to read ahead
+}
+
+#else
+
+bool mmapReader::open(const char *fileName)
+{
+    if(0 == strcmp("-", fileName))
+        return false;
+
+    m_fd = ::open(fileName, O_RDONLY);
+
+    if(-1 == m_fd)
+        return false;
+
+    struct stat statBuf;
+
+    // Pipes, devices and empty files can't be mapped
+    if(0 != fstat(m_fd, &statBuf) ||
+       !S_ISREG(statBuf.st_mode) ||
+       0 == statBuf.st_size ||
+       (uint64_t) statBuf.st_size > SIZE_MAX)
+    {
+        close();
+        return false;
+    }
+
+    void *pData = mmap(nullptr, statBuf.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+
+    if(MAP_FAILED == pData)
+    {
+        close();
+        return false;
+    }
+
+    m_pData = (uint8_t *) pData;
+    m_fileSize = statBuf.st_size;
+    m_position = 0;
+
+    // The file is walked front to back exactly once, let the kernel read ahead aggressively
+    madvise(m_pData, m_fileSize, MADV_SEQUENTIAL);
+
+    return true;
+}
+
+void mmapReader::close()
+{
+    if(m_pData)
+        munmap(m_pData, m_fileSize);
+
+    if(-1 != m_fd)
+        ::close(m_fd);
+
+    m_pData = nullptr;
+    m_fd = -1;
+}
+
+// Ask the kernel to start paging in the block after the one being parsed
+void mmapReader::adviseWillNeed(size_t position)
+{
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+    if(position >= (size_t) m_fileSize)
+        return;
+
+    size_t start = position & ~(pageSize - 1);
+    size_t length = m_blockSize + (position - start);
+
+    if(start + length > (size_t) m_fileSize)
+        length = m_fileSize - start;
+
+    madvise(m_pData + start, length, MADV_WILLNEED);
+}
+
+#endif
+
+size_t mmapReader::peek(uint8_t *buffer, size_t bytes)
+{
+    if(bytes > (size_t) m_fileSize)
+        bytes = m_fileSize;
+
+    std::memcpy(buffer, m_pData, bytes);
+
+    return bytes;
+}
+
+size_t mmapReader::read(uint8_t *&p)
+{
+    size_t bytes = m_fileSize - m_position;
+
+    if(bytes > m_blockSize)
+        bytes = m_blockSize;
+
+    p = m_pData + m_position;
+    m_position += bytes;
+
+    adviseWillNeed(m_position);
+
+    return bytes;
+}
+
+bool mmapReader::seek(int64_t offset)
+{
+    if(offset < 0 || offset > m_fileSize)
+        return false;
+
+    m_position = offset;
+    adviseWillNeed(m_position);
+
+    return true;
+}
@@ -0,0 +1,170 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Supplies the packet loop in main.cpp with blocks of transport stream data
+class mptsReader
+{
+public:
+    mptsReader()
+        : m_fileSize(0)
+        , m_blockSize(0)
+    {}
+
+    virtual ~mptsReader() {}
+
+    // A file name of "-" is stdin
+    virtual bool open(const char *fileName) = 0;
+    virtual void close() = 0;
+
+    // Copy up to bytes from the start of the input into buffer without consuming them
+    virtual size_t peek(uint8_t *buffer, size_t bytes) = 0;
+
+    // Point p at the next block of at most getBlockSize() bytes.
+    // Returns the number of bytes in the block, 0 at the end of the input.
+    // The block stays valid until the next call to read().
+    virtual size_t read(uint8_t *&p) = 0;
+
+    // Move to offset in the input, the next read() starts there.
+    // Returns false when the input can't seek, like a pipe, or asyncReader once it has started.
+    virtual bool seek(int64_t offset) = 0;
+
+    // True when blocks stay valid until close(), not just until the next read()
+    virtual bool isPinned() { return false; }
+
+    // After read() returned 0, let the next read() pick up what was added to the input since.
+    // Returns false when the reader can't, like mmapReader whose mapping has a fixed size.
+    virtual bool resume() { return false; }
+
+    void setBlockSize(size_t blockSize) { m_blockSize = blockSize; }
+    size_t getBlockSize() { return m_blockSize; }
+    int64_t getFileSize() { return m_fileSize; } // -1 when the input is a pipe
+
+protected:
+    int64_t m_fileSize;
+    size_t m_blockSize;
+};
+
+// Reads the input in blocks with fread into a heap buffer.
+// Never seeks, so it also works on stdin and pipes.
+class freadReader : public mptsReader
+{
+public:
+    freadReader();
+    virtual ~freadReader();
+
+    virtual bool open(const char *fileName) override;
+    virtual void close() override;
+    virtual size_t peek(uint8_t *buffer, size_t bytes) override;
+    virtual size_t read(uint8_t *&p) override;
+    virtual bool seek(int64_t offset) override;
+    virtual bool resume() override;
+
+protected:
+    size_t readBlock(uint8_t *buffer, size_t bytes);
+
+    FILE *m_pFile;
+    uint8_t *m_pBuffer;
+    size_t m_bufferSize;
+    std::vector<uint8_t> m_lookahead;
+    size_t m_lookaheadPosition;
+};
+
+// Reads the input on a separate thread into a ring of queueDepth blocks,
+// so the next blocks are being read while the parser works on the current one.
+class asyncReader : public freadReader
+{
+public:
+    asyncReader(size_t queueDepth);
+    virtual ~asyncReader();
+
+    virtual void close() override;
+    virtual size_t read(uint8_t *&p) override;
+    virtual bool seek(int64_t offset) override;
+
+    // The reader thread has stopped at the end of the file
+    virtual bool resume() override { return false; }
+
+private:
+    void readerThread();
+
+    struct queuedBlock
+    {
+        uint8_t *pData;
+        size_t bytes;
+    };
+
+    std::vector<queuedBlock> m_blocks;
+    size_t m_queueDepth;
+    size_t m_fillIndex;  // Next block the reader thread fills
+    size_t m_readIndex;  // Next block handed to the parser
+    size_t m_readyCount; // Blocks filled but not yet handed to the parser
+    bool m_bHolding;     // The parser is working on m_blocks[m_readIndex]
+    bool m_bEndOfFile;
+    bool m_bStop;
+    bool m_bStarted;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_filledCondition;
+    std::condition_variable m_emptiedCondition;
+};
+
+// Maps the whole input into memory so packets are parsed straight out of the page cache.
+// open() fails when the file can not be mapped, the caller should then fall back to freadReader.
+class mmapReader : public mptsReader
+{
+public:
+    mmapReader();
+    virtual ~mmapReader();
+
+    virtual bool open(const char *fileName) override;
+    virtual void close() override;
+    virtual size_t peek(uint8_t *buffer, size_t bytes) override;
+    virtual size_t read(uint8_t *&p) override;
+    virtual bool seek(int64_t offset) override;
+    virtual bool isPinned() override { return true; }
+
+private:
+    void adviseWillNeed(size_t position);
+
+    uint8_t *m_pData;
+    size_t m_position;
+
+#ifdef WINDOWS
+    void *m_hFile;
+    void *m_hMapping;
+#else
+    int m_fd;
+#endif
+};
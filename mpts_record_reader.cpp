@@ -0,0 +1,153 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#include <cstdint>
+#include <cstring>
+#include "mpts_record_reader.h"
+
+// Records read from the file at a time
+#define RECORD_READ_COUNT 4096
+
+mptsRecordReader::mptsRecordReader()
+    : m_pFile(nullptr)
+    , m_recordSize(0)
+    , m_packetSize(0)
+    , m_fileSize(-1)
+    , m_strings(1 + 256)
+    , m_position(0)
+    , m_size(0)
+{
+}
+
+mptsRecordReader::~mptsRecordReader()
+{
+    close();
+}
+
+void mptsRecordReader::close()
+{
+    if(m_pFile && stdin != m_pFile)
+        fclose(m_pFile);
+
+    m_pFile = nullptr;
+    m_position = 0;
+    m_size = 0;
+}
+
+// Make sure needed bytes are buffered from m_position on
+bool mptsRecordReader::fill(size_t needed)
+{
+    if(m_size - m_position >= needed)
+        return true;
+
+    memmove(m_buffer.data(), m_buffer.data() + m_position, m_size - m_position);
+    m_size -= m_position;
+    m_position = 0;
+
+    if(m_buffer.size() < needed)
+        m_buffer.resize(needed);
+
+    m_size += fread(m_buffer.data() + m_size, 1, m_buffer.size() - m_size, m_pFile);
+
+    return m_size >= needed;
+}
+
+bool mptsRecordReader::open(const char *fileName)
+{
+    close();
+
+    m_pFile = (0 == strcmp("-", fileName)) ? stdin : fopen(fileName, "rb");
+
+    if(nullptr == m_pFile)
+        return false;
+
+    m_buffer.resize(MPTS_RECORD_SIZE * RECORD_READ_COUNT);
+
+    if(false == fill(MPTS_RECORD_HEADER_SIZE) || 0 != memcmp(m_buffer.data(), MPTS_RECORD_MAGIC, 8))
+    {
+        close();
+        return false;
+    }
+
+    const uint8_t *p = m_buffer.data();
+
+    m_recordSize = (unsigned int) util::readLittleEndian(p + 8, 4);
+    m_packetSize = (unsigned int) util::readLittleEndian(p + 12, 4);
+    m_fileSize = (int64_t) util::readLittleEndian(p + 16, 8);
+
+    size_t stringCount = (size_t) util::readLittleEndian(p + 24, 4);
+
+    m_position += MPTS_RECORD_HEADER_SIZE;
+
+    // Later versions may only make records longer
+    if(m_recordSize < MPTS_RECORD_SIZE)
+    {
+        close();
+        return false;
+    }
+
+    if(m_buffer.size() < m_recordSize * RECORD_READ_COUNT)
+        m_buffer.resize(m_recordSize * RECORD_READ_COUNT);
+
+    m_strings.assign(stringCount > 1 + 256 ? stringCount : 1 + 256, std::string());
+
+    for(size_t i = 0; i < stringCount; i++)
+    {
+        if(false == fill(2))
+            return false;
+
+        size_t length = (size_t) util::readLittleEndian(m_buffer.data() + m_position, 2);
+        m_position += 2;
+
+        if(false == fill(length))
+            return false;
+
+        m_strings[i].assign((const char *) m_buffer.data() + m_position, length);
+        m_position += length;
+    }
+
+    return true;
+}
+
+bool mptsRecordReader::read(mptsRecord &record)
+{
+    if(nullptr == m_pFile || false == fill(m_recordSize))
+        return false;
+
+    const uint8_t *p = m_buffer.data() + m_position;
+
+    record.type = p[0];
+    record.flags = p[1];
+    record.pid = (uint16_t) util::readLittleEndian(p + 2, 2);
+    record.value = (uint32_t) util::readLittleEndian(p + 4, 4);
+    record.number = util::readLittleEndian(p + 8, 8);
+    record.position = (int64_t) util::readLittleEndian(p + 16, 8);
+    record.pts = util::readLittleEndian(p + 24, 8);
+    record.dts = util::readLittleEndian(p + 32, 8);
+
+    m_position += m_recordSize;
+
+    return true;
+}
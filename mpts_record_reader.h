@@ -0,0 +1,68 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "mpts_records.h"
+
+// Reads back the files written with --format binary, see mpts_records.h.
+// Only needs mpts_record_reader.cpp, so other tools can link it on its own.
+class mptsRecordReader
+{
+public:
+    mptsRecordReader();
+    ~mptsRecordReader();
+
+    // Read the header and the string table, false when fileName is not a record file.
+    // Use - for stdin.
+    bool open(const char *fileName);
+    void close();
+
+    // The next record, false at the end of the file
+    bool read(mptsRecord &record);
+
+    unsigned int getPacketSize() const { return m_packetSize; }
+    int64_t getFileSize() const { return m_fileSize; }
+    const std::string &getFileName() const { return m_strings[0]; }
+    const std::string &getStreamTypeName(uint8_t streamType) const { return m_strings[1 + streamType]; }
+
+private:
+    bool fill(size_t needed);
+
+    FILE *m_pFile;
+    unsigned int m_recordSize;
+    unsigned int m_packetSize;
+    int64_t m_fileSize;
+    std::vector<std::string> m_strings;
+
+    // Records are read a block at a time
+    std::vector<uint8_t> m_buffer;
+    size_t m_position;
+    size_t m_size;
+};
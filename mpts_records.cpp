@@ -0,0 +1,334 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <charconv>
+#include <string>
+#include "mpts_records.h"
+#include "mpts_parser.h"
+#include "util.h"
+
+static void writeString(const char *pString)
+{
+    uint8_t length[2];
+    size_t size = pString ? strlen(pString) : 0;
+
+    if(size > 0xFFFF)
+        size = 0xFFFF;
+
+    util::writeLittleEndian(length, size, 2);
+    util::writeOutput(length, 2);
+    util::writeOutput(pString, size);
+}
+
+void mptsBinaryWriter::begin(const char *fileName, int64_t fileSize, unsigned int packetSize)
+{
+    uint8_t header[MPTS_RECORD_HEADER_SIZE];
+
+    memcpy(header, MPTS_RECORD_MAGIC, 8);
+    util::writeLittleEndian(header + 8, MPTS_RECORD_SIZE, 4);
+    util::writeLittleEndian(header + 12, packetSize, 4);
+    util::writeLittleEndian(header + 16, (uint64_t) fileSize, 8);
+    util::writeLittleEndian(header + 24, 1 + 256, 4);
+
+    util::writeOutput(header, sizeof(header));
+
+    writeString(fileName);
+
+    for(unsigned int streamType = 0; streamType < 256; streamType++)
+        writeString(mptsParser::getStreamTypeName((uint8_t) streamType));
+}
+
+void mptsBinaryWriter::write(const mptsRecord &record)
+{
+    uint8_t p[MPTS_RECORD_SIZE];
+
+    p[0] = record.type;
+    p[1] = record.flags;
+    util::writeLittleEndian(p + 2, record.pid, 2);
+    util::writeLittleEndian(p + 4, record.value, 4);
+    util::writeLittleEndian(p + 8, record.number, 8);
+    util::writeLittleEndian(p + 16, (uint64_t) record.position, 8);
+    util::writeLittleEndian(p + 24, record.pts, 8);
+    util::writeLittleEndian(p + 32, record.dts, 8);
+
+    util::writeOutput(p, sizeof(p));
+}
+
+void mptsBinaryWriter::copy(FILE *pInput, uint64_t packetOffset, uint64_t frameOffset)
+{
+    uint8_t buffer[MPTS_RECORD_SIZE * 1024];
+    size_t count;
+
+    rewind(pInput);
+
+    while((count = fread(buffer, MPTS_RECORD_SIZE, 1024, pInput)) > 0)
+    {
+        for(uint8_t *p = buffer; p < buffer + count * MPTS_RECORD_SIZE; p += MPTS_RECORD_SIZE)
+        {
+            uint64_t offset = packetOffset;
+
+            if(eRecordFrame == p[0] || eRecordSequence == p[0])
+                offset = frameOffset;
+            else if(eRecordProgram == p[0] || eRecordStream == p[0])
+                offset = 0;
+
+            if(offset)
+                util::writeLittleEndian(p + 8, util::readLittleEndian(p + 8, 8) + offset, 8);
+        }
+
+        util::writeOutput(buffer, count * MPTS_RECORD_SIZE);
+    }
+}
+
+// One line of JSON, as long as it needs to be, integers are formatted with std::to_chars
+struct jsonLine
+{
+    std::string text;
+
+    jsonLine() { text.reserve(256); }
+
+    void append(const char *pString, size_t size) { text.append(pString, size); }
+
+    void append(const char *pString) { text.append(pString); }
+
+    void appendNumber(uint64_t value)
+    {
+        char digits[20];
+        std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+
+        text.append(digits, result.ptr - digits);
+    }
+
+    void begin(const char *type)
+    {
+        append("{\"type\":\"");
+        append(type);
+        append("\"");
+    }
+
+    void field(const char *name, uint64_t value)
+    {
+        append(",\"");
+        append(name);
+        append("\":");
+        appendNumber(value);
+    }
+
+    // Only the input name can hold characters that need escaping
+    void field(const char *name, const char *value)
+    {
+        append(",\"");
+        append(name);
+        append("\":\"");
+
+        for(const char *c = value ? value : ""; *c; c++)
+        {
+            if('"' == *c || '\\' == *c)
+            {
+                char escaped[2] = { '\\', *c };
+                append(escaped, 2);
+            }
+            else if((uint8_t) *c < 0x20)
+            {
+                char escaped[8];
+                append(escaped, snprintf(escaped, sizeof(escaped), "\\u%04x", *c));
+            }
+            else
+                append(c, 1);
+        }
+
+        append("\"");
+    }
+
+    void end()
+    {
+        text += "}\n";
+
+        util::writeOutput(text.data(), text.size());
+    }
+};
+
+static const char *recordTypeName(uint8_t type)
+{
+    switch(type)
+    {
+        case eRecordPacket: return "packet";
+        case eRecordPes: return "pes";
+        case eRecordTable: return "table";
+        case eRecordProgram: return "program";
+        case eRecordStream: return "stream";
+        case eRecordFrame: return "frame";
+        case eRecordSequence: return "sequence";
+        default: return "unknown";
+    }
+}
+
+void mptsJsonWriter::begin(const char *fileName, int64_t fileSize, unsigned int packetSize)
+{
+    jsonLine line;
+
+    line.begin("file");
+    line.field("name", fileName);
+
+    if(-1 != fileSize)
+        line.field("file_size", (uint64_t) fileSize);
+
+    line.field("packet_size", packetSize);
+    line.end();
+}
+
+// number comes right after type, copy() relies on that
+void mptsJsonWriter::write(const mptsRecord &record)
+{
+    jsonLine line;
+
+    line.begin(recordTypeName(record.type));
+
+    switch(record.type)
+    {
+        case eRecordPacket:
+            line.field("number", record.number);
+            line.field("position", (uint64_t) record.position);
+            line.field("pid", record.pid);
+            line.field("payload_unit_start_indicator", (record.flags & eRecordPayloadUnitStart) ? 1 : 0);
+            line.field("transport_error_indicator", (record.flags & eRecordTransportError) ? 1 : 0);
+            line.field("transport_priority", (record.flags & eRecordTransportPriority) ? 1 : 0);
+            line.field("scrambled", (record.flags & eRecordScrambled) ? 1 : 0);
+            line.field("adaptation_field", (record.flags & eRecordAdaptationField) ? 1 : 0);
+            line.field("payload", (record.flags & eRecordPayload) ? 1 : 0);
+            line.field("continuity_counter", record.value);
+        break;
+
+        case eRecordPes:
+            line.field("number", record.number);
+            line.field("position", (uint64_t) record.position);
+            line.field("pid", record.pid);
+            line.field("stream_id", record.value);
+
+            if(record.flags & 2)
+                line.field("pts", record.pts);
+
+            if(3 == record.flags)
+                line.field("dts", record.dts);
+        break;
+
+        case eRecordTable:
+            line.field("number", record.number);
+            line.field("position", (uint64_t) record.position);
+            line.field("pid", record.pid);
+            line.field("table_id", record.value & 0xFF);
+            line.field("table_id_extension", record.value >> 16);
+            line.field("version_number", record.flags);
+        break;
+
+        case eRecordProgram:
+            line.field("program_number", record.value);
+            line.field("program_map_pid", record.pid);
+        break;
+
+        case eRecordStream:
+            line.field("program_number", record.value);
+            line.field("pid", record.pid);
+            line.field("stream_type", record.flags);
+            line.field("stream_type_name", mptsParser::getStreamTypeName(record.flags));
+        break;
+
+        case eRecordFrame:
+        {
+            char type[2] = { (char) (record.flags & ~eRecordGopStart), 0 };
+
+            line.field("number", record.number);
+            line.field("position", (uint64_t) record.position);
+            line.field("pid", record.pid);
+            line.field("packets", record.value);
+            line.field("pts", record.pts);
+            line.field("dts", record.dts);
+
+            if(type[0])
+                line.field("picture_type", type);
+
+            if(record.flags & eRecordGopStart)
+                line.field("gop_start", 1);
+        }
+        break;
+
+        case eRecordSequence:
+            line.field("number", record.number);
+            line.field("pid", record.pid);
+            line.field("profile_idc", record.flags);
+            line.field("level_idc", record.value);
+        break;
+
+        default:
+        break;
+    }
+
+    line.end();
+}
+
+void mptsJsonWriter::copy(FILE *pInput, uint64_t packetOffset, uint64_t frameOffset)
+{
+    static const char numberField[] = "\",\"number\":";
+    std::string input;
+
+    rewind(pInput);
+
+    while(util::readLine(pInput, input))
+    {
+        // {"type":"frame","number":12,...
+        const char *text = input.c_str();
+        const char *pType = text + 9;
+        const char *pNumber = strstr(pType, numberField);
+        uint64_t offset = 0;
+
+        if(pNumber)
+        {
+            if(0 == strncmp(pType, "frame\"", 6) || 0 == strncmp(pType, "sequence\"", 9))
+                offset = frameOffset;
+            else
+                offset = packetOffset;
+
+            pNumber += sizeof(numberField) - 1;
+        }
+
+        if(offset)
+        {
+            char *pRest = nullptr;
+            jsonLine line;
+
+            line.append(text, pNumber - text);
+            line.appendNumber(strtoull(pNumber, &pRest, 10) + offset);
+            line.append(pRest);
+
+            util::writeOutput(line.text.data(), line.text.size());
+        }
+        else
+            util::writeOutput(text, input.size());
+    }
+}
@@ -0,0 +1,144 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+// Binary output, chosen with --format binary, and JSON Lines, chosen with --format jsonl,
+// for tools that would rather not parse xml.
+//
+// A file is a header, a string table and then records of MPTS_RECORD_SIZE bytes up to
+// the end of the file. Everything is little endian.
+//
+//   header   8 bytes   MPTS_RECORD_MAGIC
+//            4 bytes   MPTS_RECORD_SIZE
+//            4 bytes   packet stride of the input, 188, 192 or 204
+//            8 bytes   size of the input, -1 for a pipe
+//            4 bytes   number of strings
+//   strings  each a 2 byte length and that many bytes, without a terminator.
+//            String 0 is the input's name, string 1 + n is the name of stream_type n.
+//   records  see mptsRecord
+//
+// mpts_record_reader.h reads these files back.
+//
+// JSON Lines carry the same records, one object per line, with a "type" of file, packet,
+// pes, table, program, stream, frame or sequence, and the fields spelled out.
+// The first line describes the input.
+
+#define MPTS_RECORD_MAGIC "MPTSREC1"
+#define MPTS_RECORD_HEADER_SIZE 28
+#define MPTS_RECORD_SIZE 40
+
+enum eMptsRecordType
+{
+    eRecordPacket = 1,  // Only with -v. flags: eRecordPacketFlags, value: continuity_counter
+    eRecordPes = 2,     // A PES packet starts. flags: PTS_DTS_flags, value: stream_id, pts and dts
+    eRecordTable = 3,   // A new PAT or PMT section. flags: version_number, value: table_id | table_id_extension << 16
+    eRecordProgram = 4, // A program of the PAT before it. pid: its PMT PID, value: program_number
+    eRecordStream = 5,  // A stream of the PMT before it. flags: stream_type, value: program_number
+    eRecordFrame = 6,   // Only with -e. flags: 'I', 'P', 'B' or 0, | eRecordGopStart, value: packets, number: frame number, pts and dts
+    eRecordSequence = 7 // An H.264 SPS, before the frame that carried it. flags: profile_idc, value: level_idc, number: frame number
+};
+
+enum eRecordPacketFlags
+{
+    eRecordPayloadUnitStart = 0x01,
+    eRecordTransportError = 0x02,
+    eRecordTransportPriority = 0x04,
+    eRecordScrambled = 0x08,        // transport_scrambling_control is not 0
+    eRecordAdaptationField = 0x10,
+    eRecordPayload = 0x20
+};
+
+enum eRecordFrameFlags
+{
+    eRecordGopStart = 0x80  // A group of pictures header or an IDR picture, or'ed into the picture type
+};
+
+// One record, in the order its fields are stored
+struct mptsRecord
+{
+    uint8_t type;       // eMptsRecordType
+    uint8_t flags;
+    uint16_t pid;
+    uint32_t value;
+    uint64_t number;    // Packet number, the frame number of frames. 0 for programs and streams
+    int64_t position;   // File offset of the packet, the first packet of frames. 0 for programs and streams
+    uint64_t pts;
+    uint64_t dts;
+};
+
+// Hands the records of a parse to some output, the writer of each output format derives from this.
+// Records go to the calling thread's output, see util::setXmlFile().
+class mptsRecordWriter
+{
+public:
+    virtual ~mptsRecordWriter() {}
+
+    // Before the first record
+    virtual void begin(const char *fileName, int64_t fileSize, unsigned int packetSize) = 0;
+    virtual void write(const mptsRecord &record) = 0;
+
+    // Copy what one -j chunk wrote to its own file, adding the packets and frames of the chunks before it to their numbers
+    virtual void copy(FILE *pInput, uint64_t packetOffset, uint64_t frameOffset) = 0;
+};
+
+class mptsBinaryWriter : public mptsRecordWriter
+{
+public:
+    void begin(const char *fileName, int64_t fileSize, unsigned int packetSize) override;
+    void write(const mptsRecord &record) override;
+    void copy(FILE *pInput, uint64_t packetOffset, uint64_t frameOffset) override;
+};
+
+class mptsJsonWriter : public mptsRecordWriter
+{
+public:
+    void begin(const char *fileName, int64_t fileSize, unsigned int packetSize) override;
+    void write(const mptsRecord &record) override;
+    void copy(FILE *pInput, uint64_t packetOffset, uint64_t frameOffset) override;
+};
+
+namespace util
+{
+    inline void writeLittleEndian(uint8_t *p, uint64_t value, size_t bytes)
+    {
+        for (size_t i = 0; i < bytes; i++, value >>= 8)
+            p[i] = (uint8_t) value;
+    }
+
+    inline uint64_t readLittleEndian(const uint8_t *p, size_t bytes)
+    {
+        uint64_t value = 0;
+
+        for (size_t i = bytes; i > 0; i--)
+            value = (value << 8) | p[i - 1];
+
+        return value;
+    }
+}
@@ -0,0 +1,267 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#include <cstdint>
+#include <cstring>
+#include "mpts_section.h"
+#include "mpts_checkpoint.h"
+#include "util.h"
+
+mptsSectionAssembler::mptsSectionAssembler()
+    : m_needed(0)
+    , m_bGathering(false)
+    , m_bPointerField(false)
+    , m_pointerField(0)
+    , m_dropped(0)
+{
+    m_buffer.reserve(1024);
+}
+
+void mptsSectionAssembler::start(bool bPointerField, uint8_t pointerField)
+{
+    m_buffer.clear();
+    m_needed = 0;
+    m_bGathering = true;
+    m_bPointerField = bPointerField;
+    m_pointerField = pointerField;
+}
+
+void mptsSectionAssembler::complete()
+{
+    mptsSection section;
+
+    section.pData = nullptr;
+    section.size = m_buffer.size();
+    section.bPointerField = m_bPointerField;
+    section.pointerField = m_pointerField;
+
+    // Run over the whole section a good CRC_32 leaves nothing behind
+    section.bCrcValid = (0 == (m_buffer[1] & 0x80)) || 0 == util::crc32(m_buffer.data(), m_buffer.size());
+
+    m_complete.insert(m_complete.end(), m_buffer.begin(), m_buffer.end());
+    m_sections.push_back(section);
+
+    m_bGathering = false;
+}
+
+// Adds bytes to the open section, returns how many it used
+size_t mptsSectionAssembler::gather(const uint8_t *p, size_t size)
+{
+    size_t used = 0;
+
+    while(m_bGathering && used < size)
+    {
+        // The section_length is in the first 3 bytes
+        size_t take = (m_needed ? m_needed : 3) - m_buffer.size();
+
+        if(take > size - used)
+            take = size - used;
+
+        m_buffer.insert(m_buffer.end(), p + used, p + used + take);
+        used += take;
+
+        if(0 == m_needed)
+        {
+            if(m_buffer.size() < 3)
+                break;
+
+            m_needed = 3 + (util::read2Bytes(m_buffer.data() + 1) & 0xFFF);
+
+            // Nothing after a bad section_length can be trusted, skip the rest of the packet
+            if(m_needed > SECTION_MAX_SIZE || ((m_buffer[1] & 0x80) && m_needed < SECTION_MIN_SIZE))
+            {
+                m_bGathering = false;
+                m_dropped++;
+                return size;
+            }
+        }
+
+        if(m_buffer.size() == m_needed)
+            complete();
+    }
+
+    return used;
+}
+
+size_t mptsSectionAssembler::push(const uint8_t *payload, size_t size, bool payloadUnitStart)
+{
+    m_complete.clear();
+    m_sections.clear();
+
+    const uint8_t *p = payload;
+    const uint8_t *pEnd = payload + size;
+
+    if(payloadUnitStart && size)
+    {
+        uint8_t pointerField = *p++;
+
+        if(pointerField > pEnd - p)
+            pointerField = (uint8_t) (pEnd - p);
+
+        // The bytes up to where the pointer_field points finish the section from the packets before
+        gather(p, pointerField);
+
+        if(m_bGathering)
+        {
+            m_bGathering = false;
+            m_dropped++;
+        }
+
+        p += pointerField;
+
+        for(bool bFirst = true; p < pEnd && 0xFF != *p; bFirst = false)
+        {
+            start(bFirst, pointerField);
+            p += gather(p, pEnd - p);
+
+            // It carries on in the next packet
+            if(m_bGathering)
+                break;
+        }
+    }
+    else
+    {
+        // Whatever follows the end of the section is stuffing
+        gather(p, size);
+    }
+
+    size_t offset = 0;
+
+    for(mptsSection &section : m_sections)
+    {
+        section.pData = m_complete.data() + offset;
+        offset += section.size;
+    }
+
+    return m_sections.size();
+}
+
+bool mptsTableCache::isRepeat(uint16_t pid, const mptsSection &section)
+{
+    const uint8_t *p = section.pData;
+    uint64_t key = ((uint64_t) pid << 32) | ((uint64_t) p[0] << 24);
+    uint8_t version = 0;
+    uint32_t crc = 0;
+
+    // Short form sections have no table_id_extension, version_number or CRC_32
+    if((p[1] & 0x80) && section.size >= SECTION_MIN_SIZE)
+    {
+        key |= (util::read2Bytes((uint8_t *) p + 3) << 8) | p[6];
+        version = (p[5] >> 1) & 0x1F;
+        crc = util::read4Bytes((uint8_t *) p + section.size - 4);
+    }
+
+    table &t = m_tables[key];
+
+    if(t.section.size() == section.size && t.version == version && t.crc == crc &&
+       0 == std::memcmp(t.section.data(), p, section.size))
+    {
+        t.repeats++;
+        return true;
+    }
+
+    t.version = version;
+    t.crc = crc;
+    t.section.assign(p, p + section.size);
+    t.versions++;
+
+    return false;
+}
+
+void mptsTableCache::copyTables(const mptsTableCache &other)
+{
+    m_tables = other.m_tables;
+
+    for(auto &[key, t] : m_tables)
+    {
+        t.versions = 0;
+        t.repeats = 0;
+    }
+}
+
+void mptsTableCache::append(const mptsTableCache &next)
+{
+    for(const auto &[key, other] : next.m_tables)
+    {
+        table &t = m_tables[key];
+
+        t.version = other.version;
+        t.crc = other.crc;
+        t.section = other.section;
+        t.versions += other.versions;
+        t.repeats += other.repeats;
+    }
+}
+
+void mptsTableCache::save(mptsCheckpoint &checkpoint) const
+{
+    checkpoint.put(m_tables.size());
+
+    for(const auto &[key, t] : m_tables)
+    {
+        checkpoint.put(key);
+        checkpoint.put(t.version);
+        checkpoint.put(t.crc);
+        checkpoint.put(t.section);
+        checkpoint.put(t.versions);
+        checkpoint.put(t.repeats);
+    }
+}
+
+void mptsTableCache::load(mptsCheckpoint &checkpoint)
+{
+    uint64_t tables = checkpoint.get();
+
+    m_tables.clear();
+
+    for(uint64_t i = 0; i < tables && checkpoint.isGood(); i++)
+    {
+        table &t = m_tables[checkpoint.get()];
+
+        t.version = (uint8_t) checkpoint.get();
+        t.crc = (uint32_t) checkpoint.get();
+        t.section = checkpoint.getBytes();
+        t.versions = checkpoint.get();
+        t.repeats = checkpoint.get();
+    }
+}
+
+void mptsTableCache::print() const
+{
+    util::printfXml(1, "<tables>\n");
+
+    for(const auto &[key, t] : m_tables)
+    {
+        // Copied from another cache, and not seen since
+        if(0 == t.versions + t.repeats)
+            continue;
+
+        util::printfXml(2, "<table pid=\"0x%x\" table_id=\"0x%x\" extension=\"0x%x\" section=\"%u\" version=\"%u\" versions=\"%llu\" repeats=\"%llu\"/>\n",
+            (unsigned int) (key >> 32), (unsigned int) (key >> 24) & 0xFF, (unsigned int) (key >> 8) & 0xFFFF, (unsigned int) key & 0xFF,
+            t.version, t.versions, t.repeats);
+    }
+
+    util::printfXml(1, "</tables>\n");
+}
@@ -0,0 +1,129 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <map>
+
+class mptsCheckpoint;
+
+// Largest section, 3 header bytes and a section_length of up to 4093 for private sections
+#define SECTION_MAX_SIZE 4096
+
+// Smallest long form section, the 3 header bytes, 5 bytes up to last_section_number and the CRC_32
+#define SECTION_MIN_SIZE 12
+
+// A complete section, from table_id to the end of its CRC_32
+struct mptsSection
+{
+    const uint8_t *pData;
+    size_t size;
+    bool bPointerField;     // It began right after the pointer_field of its packet
+    uint8_t pointerField;
+    bool bCrcValid;         // Always true for short form sections, they have no CRC_32
+};
+
+// Puts back together the sections of one PSI PID.
+//
+// A section may start anywhere after the pointer_field of a payload unit start and
+// carry on over any number of packets, and a packet may end one section and start
+// several more. Stuffing, a table_id of 0xFF, ends the sections of a packet.
+// A section that is still open when the next one starts is thrown away.
+class mptsSectionAssembler
+{
+public:
+    mptsSectionAssembler();
+
+    // The payload of one packet, after any adaptation field.
+    // Returns how many sections it completed, they stay valid until the next push().
+    size_t push(const uint8_t *payload, size_t size, bool payloadUnitStart);
+
+    const mptsSection &getSection(size_t i) const { return m_sections[i]; }
+
+    // Sections thrown away unfinished, or for a section_length out of range
+    uint64_t getDroppedCount() const { return m_dropped; }
+
+private:
+    void start(bool bPointerField, uint8_t pointerField);
+    size_t gather(const uint8_t *p, size_t size);
+    void complete();
+
+    std::vector<uint8_t> m_buffer;      // The section being gathered
+    size_t m_needed;                    // Its size, or 3 until its section_length is in
+    bool m_bGathering;
+    bool m_bPointerField;
+    uint8_t m_pointerField;
+
+    std::vector<uint8_t> m_complete;    // The sections the last push() completed, back to back
+    std::vector<mptsSection> m_sections;
+    uint64_t m_dropped;
+};
+
+// Remembers the last section of every table on the PSI PIDs, so the PAT and PMT that
+// come round every 100 ms or so are only parsed and printed when they change.
+//
+// A table is a table_id, table_id_extension and section_number on a PID. A section is a
+// repeat when its version_number and CRC_32 match the last one of its table, and all of its bytes do.
+class mptsTableCache
+{
+public:
+    // Either way the section becomes the last one of its table
+    bool isRepeat(uint16_t pid, const mptsSection &section);
+
+    // Start from the tables another cache has seen, without its counts
+    void copyTables(const mptsTableCache &other);
+
+    // Add the counts of the part of the stream that comes straight after this one
+    void append(const mptsTableCache &next);
+
+    // Save what append() needs to carry on from here, and load it back into a new object, see mpts_checkpoint.h
+    void save(mptsCheckpoint &checkpoint) const;
+    void load(mptsCheckpoint &checkpoint);
+
+    // Write how many versions and repeats of each table there were as xml
+    void print() const;
+
+private:
+    struct table
+    {
+        table()
+            : version(0)
+            , crc(0)
+            , versions(0)
+            , repeats(0)
+        {}
+
+        uint8_t version;
+        uint32_t crc;
+        std::vector<uint8_t> section;
+        uint64_t versions;      // Sections that differed from the one before, and were printed
+        uint64_t repeats;       // Sections skipped as the same as the one before
+    };
+
+    std::map<uint64_t, table> m_tables;     // By PID, table_id, table_id_extension and section_number
+};
@@ -0,0 +1,143 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include "mpts_seek.h"
+#include "mpts_sync.h"
+#include "util.h"
+
+#define TIME_STAMP_MASK ((1ULL << 33) - 1)
+
+mptsSeek::mptsSeek(mptsReader &reader, int64_t fileSize, unsigned int packetStride, const std::vector<bool> &videoPids)
+    : m_reader(reader)
+    , m_fileSize(fileSize)
+    , m_packetStride(packetStride)
+    , m_videoPids(videoPids)
+{
+}
+
+// Take the DTS, or the PTS when there is no DTS, from a packet that starts a PES packet
+bool mptsSeek::readTimeStamp(const uint8_t *packet, uint64_t &timeStamp)
+{
+    uint16_t pid = util::read2Bytes((uint8_t *) packet + 1);
+
+    if(0 == (pid & 0x4000))
+        return false;
+
+    pid &= 0x1FFF;
+
+    if(m_videoPids.size() && false == m_videoPids[pid])
+        return false;
+
+    const uint8_t *p = packet + 4;
+    uint8_t adaptationFieldControl = (packet[3] & 0x30) >> 4;
+
+    if(2 == adaptationFieldControl)
+        return false;
+
+    if(3 == adaptationFieldControl)
+        p += 1 + *p;
+
+    // Start code, stream_id, PES_packet_length, two flag bytes, PES_header_data_length and 5 time stamp bytes
+    if(p + 14 > packet + TS_PACKET_SIZE)
+        return false;
+
+    if(0x000001 != util::read3Bytes((uint8_t *) p))
+        return false;
+
+    uint8_t PTS_DTS_flags = (p[7] & 0xC0) >> 6;
+
+    if(PTS_DTS_flags < 2)
+        return false;
+
+    // The PTS comes first, the DTS after it
+    const uint8_t *pTime = p + 9;
+
+    if(3 == PTS_DTS_flags && p + 19 <= packet + TS_PACKET_SIZE)
+        pTime += 5;
+
+    timeStamp = ((uint64_t) (pTime[0] & 0x0E)) << 29;
+    timeStamp |= ((uint64_t) (util::read2Bytes((uint8_t *) pTime + 1) & 0xFFFE)) << 14;
+    timeStamp |= (util::read2Bytes((uint8_t *) pTime + 3) & 0xFFFE) >> 1;
+
+    return true;
+}
+
+// First time stamp found from position on, within SEEK_PROBE_SIZE bytes
+bool mptsSeek::timeStampAt(int64_t position, uint64_t &timeStamp)
+{
+    if(false == m_reader.seek(position))
+        return false;
+
+    m_reader.setBlockSize(SEEK_PROBE_SIZE);
+
+    uint8_t *block = nullptr, *packet;
+    size_t blockSize = m_reader.read(block);
+    size_t runCount = 0;
+    int64_t runOffset = 0;
+
+    mptsSync sync(m_packetStride, position);
+    unsigned int syncOffset = sync.getSyncOffset();
+
+    sync.setBlock(block, blockSize);
+
+    while(sync.nextRun(packet, runCount, runOffset))
+    {
+        for(size_t i = 0; i < runCount; i++, packet += m_packetStride)
+        {
+            if(readTimeStamp(packet + syncOffset, timeStamp))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+int64_t mptsSeek::findTime(double seconds, bool bAfter)
+{
+    uint64_t first = 0;
+
+    if(false == timeStampAt(0, first))
+        return -1;
+
+    uint64_t target = (uint64_t) (seconds * 90000.);
+
+    int64_t low = 0;
+    int64_t high = m_fileSize;
+
+    // Time stamps are compared relative to the first one, which takes care of a wrap around
+    while(high - low > SEEK_PRECISION)
+    {
+        int64_t middle = low + (((high - low) / 2) / m_packetStride) * m_packetStride;
+        uint64_t timeStamp = 0;
+
+        if(timeStampAt(middle, timeStamp) && ((timeStamp - first) & TIME_STAMP_MASK) < target)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    return bAfter ? high : low;
+}
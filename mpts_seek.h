@@ -0,0 +1,59 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "mpts_reader.h"
+
+// Bytes read at each probe while looking for a time stamp
+#define SEEK_PROBE_SIZE (1024 * 1024)
+
+// The search stops once it has narrowed the position down to this many bytes
+#define SEEK_PRECISION (64 * 1024)
+
+// Finds the file position of a time by bisecting on the PES time stamps of the video PIDs.
+// Times are in seconds from the first time stamp in the file, and assume the time stamps
+// only ever go up, apart from wrapping around at 33 bits.
+class mptsSeek
+{
+public:
+    // videoPids has an entry for each of the 0x2000 PIDs, an empty vector uses any PES packet
+    mptsSeek(mptsReader &reader, int64_t fileSize, unsigned int packetStride, const std::vector<bool> &videoPids);
+
+    // Returns a packet aligned position at or before the time when bAfter is false,
+    // or at or after it when bAfter is true. Returns -1 when the file has no time stamps.
+    int64_t findTime(double seconds, bool bAfter);
+
+private:
+    bool timeStampAt(int64_t position, uint64_t &timeStamp);
+    bool readTimeStamp(const uint8_t *packet, uint64_t &timeStamp);
+
+    mptsReader &m_reader;
+    int64_t m_fileSize;
+    unsigned int m_packetStride;
+    const std::vector<bool> &m_videoPids;
+    std::vector<uint8_t> m_probe;
+};
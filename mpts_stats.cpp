@@ -0,0 +1,324 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include <cstdint>
+#include "mpts_stats.h"
+#include "mpts_checkpoint.h"
+#include "mpts_parser.h"
+#include "mpts_sync.h"
+#include "util.h"
+
+// An Exp-Golomb code, 9.1 of H.264. Returns false when it runs past end.
+static bool readUe(const uint8_t *p, size_t end, size_t &bit, uint32_t &value)
+{
+    unsigned int zeros = 0;
+
+    while(bit < end * 8 && 0 == (p[bit >> 3] & (0x80 >> (bit & 7))))
+    {
+        zeros++;
+        bit++;
+    }
+
+    if(zeros > 31 || bit + zeros >= end * 8)
+        return false;
+
+    bit++;
+    value = 0;
+
+    for(unsigned int i = 0; i < zeros; i++, bit++)
+        value = (value << 1) | ((p[bit >> 3] >> (7 - (bit & 7))) & 1);
+
+    value += (1u << zeros) - 1;
+
+    return true;
+}
+
+mptsStats::mptsStats()
+    : m_pids(ePidCount)
+    , m_packets(0)
+{
+}
+
+void mptsStats::setStreamType(uint16_t pid, uint8_t streamType, const char *pName)
+{
+    m_pids[pid & 0x1FFF].streamType = streamType;
+    m_pids[pid & 0x1FFF].pName = pName;
+}
+
+// 'I', 'P' or 'B' once the start of the frame says, '?' when it never will, 0 when more is needed
+char mptsStats::findFrameType(pidStats &stats)
+{
+    const std::vector<uint8_t> &head = stats.head;
+    size_t i = stats.scanned;
+
+    for(; i + 3 < head.size(); i++)
+    {
+        if(0 != head[i] || 0 != head[i + 1] || 1 != head[i + 2])
+            continue;
+
+        const uint8_t *p = head.data() + i + 3;
+        size_t left = head.size() - i - 3;
+
+        if(eMPEG2_Video == stats.streamType)
+        {
+            // picture_start_code, then temporal_reference and picture_coding_type
+            if(0x00 != p[0])
+                continue;
+
+            if(left < 3)
+                break;
+
+            return "?IPB????"[(p[2] >> 3) & 0x07];
+        }
+
+        uint8_t nalType = p[0] & 0x1F;
+
+        if(5 == nalType)
+            return 'I';
+
+        if(1 != nalType)
+            continue;
+
+        // first_mb_in_slice, then slice_type
+        size_t bit = 8;
+        uint32_t firstMb = 0, sliceType = 0;
+
+        if(false == readUe(p, left, bit, firstMb) || false == readUe(p, left, bit, sliceType))
+        {
+            if(left < 8)
+                break;
+
+            return '?';
+        }
+
+        return "PBIPI"[sliceType % 5];
+    }
+
+    stats.scanned = i;
+
+    return head.size() >= STATS_TYPE_SEARCH_BYTES ? '?' : 0;
+}
+
+void mptsStats::searchFrameType(pidStats &stats, const uint8_t *payload, size_t size, bool bStart)
+{
+    if(bStart)
+    {
+        stats.head.clear();
+        stats.scanned = 0;
+        stats.bSearching = true;
+
+        // Skip the PES header
+        if(size >= 9 && 0x000001 == util::read3Bytes((uint8_t *) payload))
+        {
+            size_t headerSize = 9 + payload[8];
+
+            payload += headerSize < size ? headerSize : size;
+            size -= headerSize < size ? headerSize : size;
+        }
+    }
+
+    if(false == stats.bSearching)
+        return;
+
+    if(stats.head.size() + size > STATS_TYPE_SEARCH_BYTES)
+        size = STATS_TYPE_SEARCH_BYTES - stats.head.size();
+
+    stats.head.insert(stats.head.end(), payload, payload + size);
+
+    switch(findFrameType(stats))
+    {
+        case 'I':
+            stats.iFrames++;
+        break;
+        case 'P':
+            stats.pFrames++;
+        break;
+        case 'B':
+            stats.bFrames++;
+        break;
+        case 0:
+            return;
+        default:
+        break;
+    }
+
+    stats.bSearching = false;
+    stats.head.clear();
+}
+
+void mptsStats::check(const mptsHeaders &headers, size_t first, size_t last, const uint8_t *packets, unsigned int stride)
+{
+    m_packets += last - first;
+    packets += first * stride;
+
+    for(size_t i = first; i < last; i++, packets += stride)
+    {
+        pidStats &stats = m_pids[headers.pid[i]];
+        uint8_t adaptationFieldControl = headers.adaptationFieldControl[i];
+
+        stats.packets++;
+
+        if(0 == (adaptationFieldControl & 0x01))
+            continue;
+
+        size_t offset = 4;
+
+        if(adaptationFieldControl & 0x02)
+            offset += 1 + packets[4];
+
+        if(offset >= TS_PACKET_SIZE)
+            continue;
+
+        bool bStart = 0 != (headers.flags[i] & eHeaderPayloadUnitStart);
+
+        stats.payloadBytes += TS_PACKET_SIZE - offset;
+
+        if(bStart)
+            stats.payloadUnitStarts++;
+
+        if(eMPEG2_Video != stats.streamType && eH264_Video != stats.streamType)
+            continue;
+
+        if(bStart)
+            stats.frames++;
+
+        if(bStart || stats.bSearching)
+            searchFrameType(stats, packets + offset, TS_PACKET_SIZE - offset, bStart);
+    }
+}
+
+void mptsStats::append(const mptsStats &next)
+{
+    m_packets += next.m_packets;
+
+    for(size_t pid = 0; pid < m_pids.size(); pid++)
+    {
+        pidStats &stats = m_pids[pid];
+        const pidStats &other = next.m_pids[pid];
+
+        stats.packets += other.packets;
+        stats.payloadBytes += other.payloadBytes;
+        stats.payloadUnitStarts += other.payloadUnitStarts;
+        stats.frames += other.frames;
+        stats.iFrames += other.iFrames;
+        stats.pFrames += other.pFrames;
+        stats.bFrames += other.bFrames;
+
+        if(other.pName)
+        {
+            stats.streamType = other.streamType;
+            stats.pName = other.pName;
+        }
+    }
+}
+
+// Only the counts of the PIDs that had packets, a frame type still being searched for is left to the chunk it is in
+void mptsStats::save(mptsCheckpoint &checkpoint) const
+{
+    uint64_t seen = 0;
+
+    for(const pidStats &stats : m_pids)
+    {
+        if(stats.packets)
+            seen++;
+    }
+
+    checkpoint.put(m_packets);
+    checkpoint.put(seen);
+
+    for(size_t pid = 0; pid < m_pids.size(); pid++)
+    {
+        const pidStats &stats = m_pids[pid];
+
+        if(0 == stats.packets)
+            continue;
+
+        checkpoint.put(pid);
+        checkpoint.put(stats.packets);
+        checkpoint.put(stats.payloadBytes);
+        checkpoint.put(stats.payloadUnitStarts);
+        checkpoint.put(stats.frames);
+        checkpoint.put(stats.iFrames);
+        checkpoint.put(stats.pFrames);
+        checkpoint.put(stats.bFrames);
+        checkpoint.put(stats.streamType);
+        checkpoint.put(nullptr != stats.pName);
+    }
+}
+
+void mptsStats::load(mptsCheckpoint &checkpoint)
+{
+    m_packets = checkpoint.get();
+
+    uint64_t seen = checkpoint.get();
+
+    for(uint64_t i = 0; i < seen && checkpoint.isGood(); i++)
+    {
+        pidStats &stats = m_pids[checkpoint.get() & 0x1FFF];
+
+        stats.packets = checkpoint.get();
+        stats.payloadBytes = checkpoint.get();
+        stats.payloadUnitStarts = checkpoint.get();
+        stats.frames = checkpoint.get();
+        stats.iFrames = checkpoint.get();
+        stats.pFrames = checkpoint.get();
+        stats.bFrames = checkpoint.get();
+        stats.streamType = (uint8_t) checkpoint.get();
+
+        // The names are the parser's own strings
+        if(checkpoint.get())
+            stats.pName = mptsParser::getStreamTypeName(stats.streamType);
+    }
+}
+
+void mptsStats::print() const
+{
+    util::printfXml(1, "<stats packets=\"%llu\" bytes=\"%llu\">\n", m_packets, m_packets * TS_PACKET_SIZE);
+
+    for(size_t pid = 0; pid < m_pids.size(); pid++)
+    {
+        const pidStats &stats = m_pids[pid];
+
+        if(0 == stats.packets)
+            continue;
+
+        if(eMPEG2_Video == stats.streamType || eH264_Video == stats.streamType)
+        {
+            util::printfXml(2, "<pid number=\"0x%x\" type=\"%s\" packets=\"%llu\" payload_bytes=\"%llu\" pusi=\"%llu\" frames=\"%llu\" i=\"%llu\" p=\"%llu\" b=\"%llu\"/>\n",
+                (unsigned int) pid, stats.pName, stats.packets, stats.payloadBytes, stats.payloadUnitStarts, stats.frames, stats.iFrames, stats.pFrames, stats.bFrames);
+        }
+        else if(stats.pName)
+        {
+            util::printfXml(2, "<pid number=\"0x%x\" type=\"%s\" packets=\"%llu\" payload_bytes=\"%llu\" pusi=\"%llu\"/>\n",
+                (unsigned int) pid, stats.pName, stats.packets, stats.payloadBytes, stats.payloadUnitStarts);
+        }
+        else
+        {
+            util::printfXml(2, "<pid number=\"0x%x\" packets=\"%llu\" payload_bytes=\"%llu\" pusi=\"%llu\"/>\n",
+                (unsigned int) pid, stats.packets, stats.payloadBytes, stats.payloadUnitStarts);
+        }
+    }
+
+    util::printfXml(1, "</stats>\n");
+}
@@ -0,0 +1,91 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "mpts_headers.h"
+
+class mptsCheckpoint;
+
+// Bytes from the start of a frame searched for its picture type before giving up
+#define STATS_TYPE_SEARCH_BYTES 4096
+
+// Counts packets, payload bytes, payload unit starts, frames and frame types per PID,
+// for --stats which prints only this summary.
+//
+// Every payload unit start on a video PID is a frame. Its type comes from the MPEG-2
+// picture header, or the slice_type of the first H.264 slice, and is left unknown when
+// that is not in the first STATS_TYPE_SEARCH_BYTES of the frame.
+class mptsStats
+{
+public:
+    mptsStats();
+
+    // What the PMT says a PID carries, frames are only counted on MPEG-2 and H.264 video PIDs
+    void setStreamType(uint16_t pid, uint8_t streamType, const char *pName);
+
+    // Count the packets first up to last of a batch of decoded headers,
+    // packets pointing at the sync byte of the batch's first packet, stride bytes apart
+    void check(const mptsHeaders &headers, size_t first, size_t last, const uint8_t *packets, unsigned int stride);
+
+    // Add the counts of the part of the stream that comes straight after this one
+    void append(const mptsStats &next);
+
+    // Save what append() needs to carry on from here, and load it back into a new object, see mpts_checkpoint.h
+    void save(mptsCheckpoint &checkpoint) const;
+    void load(mptsCheckpoint &checkpoint);
+
+    // Write the totals and a line for each PID seen as xml
+    void print() const;
+
+    uint64_t getPacketCount() const { return m_packets; }
+
+private:
+    struct pidStats
+    {
+        uint64_t packets;
+        uint64_t payloadBytes;
+        uint64_t payloadUnitStarts;
+        uint64_t frames;
+        uint64_t iFrames;
+        uint64_t pFrames;
+        uint64_t bFrames;
+        uint8_t streamType;
+        const char *pName;
+
+        // The start of the current frame, kept until its type is found
+        bool bSearching;
+        size_t scanned;
+        std::vector<uint8_t> head;
+    };
+
+    void searchFrameType(pidStats &stats, const uint8_t *payload, size_t size, bool bStart);
+    char findFrameType(pidStats &stats);
+
+    std::vector<pidStats> m_pids; // Indexed by PID
+    uint64_t m_packets;
+};
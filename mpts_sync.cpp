@@ -0,0 +1,348 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include "mpts_sync.h"
+#include "util.h"
+
+mptsSync::mptsSync(unsigned int packetStride, int64_t startOffset)
+    : m_packetStride(packetStride)
+    , m_syncOffset(192 == packetStride ? 4 : 0)
+    , m_pData(nullptr)
+    , m_size(0)
+    , m_position(0)
+    , m_dataOffset(0)
+    , m_pBlock(nullptr)
+    , m_blockSize(0)
+    , m_blockOffset(startOffset)
+    , m_carrySize(0)
+    , m_carryOffset(0)
+    , m_bStitching(false)
+    , m_bEndOfInput(false)
+    , m_bSynced(false)
+    , m_lossStart(startOffset)
+    , m_lostBytes(0)
+    , m_resyncCount(0)
+{
+    m_stitch.reserve(2 * SYNC_CONFIRM_PACKETS * packetStride);
+}
+
+// Is this mpts from an OTA broadcast (188 byte packets), a BluRay (192 byte packets)
+// or a DVB-ASI capture with Reed-Solomon parity (204 byte packets)?
+// See: https://github.com/lerks/BluRay/wiki/M2TS
+//
+// Each stride is tried at every starting offset, the one with the longest run of
+// sync bytes wins. Ties go to the more common stride.
+int mptsSync::determinePacketSize(const uint8_t *buffer, size_t bufferSize)
+{
+    static const unsigned int strides[] = { 188, 192, 204 };
+
+    int bestStride = -1;
+    size_t bestCount = 0;
+
+    for(unsigned int stride : strides)
+    {
+        unsigned int syncOffset = (192 == stride) ? 4 : 0;
+
+        for(size_t start = 0; start < stride && start + syncOffset < bufferSize; start++)
+        {
+            size_t count = 0;
+
+            for(size_t i = start + syncOffset; i < bufferSize && SYNC_BYTE == buffer[i]; i += stride)
+                count++;
+
+            if(count > bestCount)
+            {
+                bestStride = stride;
+                bestCount = count;
+            }
+
+            if(count >= SYNC_CONFIRM_PACKETS)
+                break;
+        }
+    }
+
+    // Short inputs can't hold SYNC_CONFIRM_PACKETS packets, require as many as fit
+    size_t needed = bufferSize / TS_PACKET_SIZE;
+
+    if(needed > SYNC_CONFIRM_PACKETS)
+        needed = SYNC_CONFIRM_PACKETS;
+
+    if(0 == needed)
+        needed = 1;
+
+    if(bestCount < needed)
+        return -1;
+
+    return bestStride;
+}
+
+void mptsSync::setBlock(uint8_t *data, size_t size)
+{
+    m_blockOffset += m_blockSize;
+    m_pBlock = data;
+    m_blockSize = size;
+    m_bEndOfInput = (0 == size);
+
+    if(m_carrySize)
+    {
+        // Stitch the leftovers of the last block to enough of this one to finish, or confirm, any packet starting in them
+        size_t extra = SYNC_CONFIRM_PACKETS * m_packetStride;
+
+        if(extra > size)
+            extra = size;
+
+        m_stitch.resize(m_carrySize + extra);
+        std::memcpy(m_stitch.data() + m_carrySize, data, extra);
+
+        m_pData = m_stitch.data();
+        m_size = m_stitch.size();
+        m_dataOffset = m_carryOffset;
+        m_bStitching = true;
+    }
+    else
+    {
+        m_pData = data;
+        m_size = size;
+        m_dataOffset = m_blockOffset;
+        m_bStitching = false;
+    }
+
+    m_position = 0;
+}
+
+inline bool mptsSync::syncAt(size_t position)
+{
+    return SYNC_BYTE == m_pData[position + m_syncOffset];
+}
+
+// Only the sync bytes that are inside the region are checked,
+// the caller makes sure there are enough of them unless the input has ended
+bool mptsSync::confirmAt(size_t position)
+{
+    for(unsigned int i = 1; i < SYNC_CONFIRM_PACKETS; i++)
+    {
+        size_t next = position + i * m_packetStride;
+
+        if(next + m_syncOffset >= m_size)
+            break;
+
+        if(false == syncAt(next))
+            return false;
+    }
+
+    return true;
+}
+
+// Save the bytes from position to the end of the region for the next block
+void mptsSync::keepTail(size_t position)
+{
+    size_t tailSize = m_size - position;
+
+    // While stitching the stitch buffer always holds all of the current block at this point
+    if(m_bStitching)
+    {
+        std::memmove(m_stitch.data(), m_stitch.data() + position, tailSize);
+        m_stitch.resize(tailSize);
+    }
+    else
+    {
+        m_stitch.resize(tailSize);
+        std::memcpy(m_stitch.data(), m_pData + position, tailSize);
+    }
+
+    m_carrySize = tailSize;
+    m_carryOffset = m_dataOffset + position;
+
+    m_pData = nullptr;
+    m_size = 0;
+    m_position = 0;
+    m_bStitching = false;
+}
+
+// Every packet that started in the carried bytes has been handled, continue in the block itself
+void mptsSync::switchToBlock()
+{
+    m_position -= m_carrySize;
+    m_carrySize = 0;
+    m_stitch.clear();
+
+    m_pData = m_pBlock;
+    m_size = m_blockSize;
+    m_dataOffset = m_blockOffset;
+    m_bStitching = false;
+}
+
+// Everything from m_lossStart up to endOffset was skipped
+void mptsSync::recordLoss(int64_t endOffset)
+{
+    if(endOffset > m_lossStart)
+    {
+        int64_t bytes = endOffset - m_lossStart;
+
+        m_lostBytes += bytes;
+        m_resyncCount++;
+
+        if(m_losses.size() < SYNC_MAX_RECORDED_LOSSES)
+            m_losses.emplace_back(m_lossStart, bytes);
+    }
+}
+
+void mptsSync::locked(size_t position)
+{
+    recordLoss(m_dataOffset + position);
+
+    m_bSynced = true;
+    m_position = position;
+}
+
+bool mptsSync::nextRun(uint8_t *&p, size_t &count, int64_t &fileOffset)
+{
+    for(;;)
+    {
+        if(m_bStitching && m_position >= m_carrySize)
+            switchToBlock();
+
+        if(nullptr == m_pData)
+            return false;
+
+        // Packets must start in the carried bytes while stitching, the rest are found in the block itself
+        size_t limit = m_bStitching ? m_carrySize : m_size;
+
+        if(m_bSynced)
+        {
+            if(m_size - m_position < m_packetStride)
+            {
+                keepTail(m_position);
+                return false;
+            }
+
+            if(syncAt(m_position))
+            {
+                size_t position = m_position;
+                count = 0;
+
+                while(position < limit && position + m_packetStride <= m_size && syncAt(position))
+                {
+                    count++;
+                    position += m_packetStride;
+                }
+
+                p = m_pData + m_position;
+                fileOffset = m_dataOffset + m_position;
+                m_position = position;
+
+                return true;
+            }
+
+            m_bSynced = false;
+            m_lossStart = m_dataOffset + m_position;
+        }
+
+        // Scan forward for SYNC_CONFIRM_PACKETS sync bytes in a row
+        size_t position = m_position;
+        bool bFound = false;
+
+        while(position < limit && position + m_syncOffset < m_size)
+        {
+            size_t searchSize = m_size - position - m_syncOffset;
+            size_t hit = util::findSyncByte(m_pData + position + m_syncOffset, searchSize);
+
+            if(hit == searchSize)
+            {
+                position = m_size;
+                break;
+            }
+
+            position += hit;
+
+            if(position >= limit)
+                break;
+
+            // Not enough data left to confirm, try again once the next block arrives.
+            // At the end of the input settle for the packets that are left.
+            if(position + SYNC_CONFIRM_PACKETS * m_packetStride > m_size)
+            {
+                if(false == m_bEndOfInput)
+                {
+                    keepTail(position);
+                    return false;
+                }
+
+                if(position + m_packetStride > m_size)
+                {
+                    position = m_size;
+                    break;
+                }
+            }
+
+            if(confirmAt(position))
+            {
+                bFound = true;
+                break;
+            }
+
+            position++;
+        }
+
+        if(bFound)
+        {
+            locked(position);
+            continue;
+        }
+
+        if(m_bStitching)
+        {
+            m_position = m_carrySize;
+            continue;
+        }
+
+        // Nothing lines up in this block, keep its end in case a packet starts there
+        size_t keep = SYNC_CONFIRM_PACKETS * m_packetStride - 1;
+        size_t tail = m_size > keep ? m_size - keep : 0;
+
+        keepTail(tail > m_position ? tail : m_position);
+        return false;
+    }
+}
+
+void mptsSync::finish()
+{
+    if(false == m_bSynced)
+    {
+        recordLoss(m_blockOffset + m_blockSize);
+        m_lossStart = m_blockOffset + m_blockSize;
+    }
+    else if(m_carrySize)
+    {
+        // The input ended in the middle of a packet
+        m_lossStart = m_carryOffset;
+        recordLoss(m_carryOffset + m_carrySize);
+        m_lossStart = m_carryOffset + m_carrySize;
+    }
+
+    m_carrySize = 0;
+    m_stitch.clear();
+}
@@ -0,0 +1,123 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#define SYNC_BYTE 0x47
+#define TS_PACKET_SIZE 188
+
+// Number of sync bytes, one packet apart, that must line up before we trust a packet boundary
+#define SYNC_CONFIRM_PACKETS 5
+
+// Only the first few lost byte ranges are kept, the rest are just counted
+#define SYNC_MAX_RECORDED_LOSSES 32
+
+// Bytes needed by mptsSync::determinePacketSize to confirm the largest stride
+#define SYNC_SNIFF_SIZE (SYNC_CONFIRM_PACKETS * 204 + 204)
+
+struct syncLoss
+{
+    syncLoss(int64_t fileOffset, int64_t bytes)
+        : fileOffset(fileOffset)
+        , bytes(bytes) {}
+
+    int64_t fileOffset;
+    int64_t bytes;
+};
+
+// Cuts arbitrary blocks of input into runs of sync aligned packets.
+//
+// Packets are 188 bytes, 192 bytes for BluRay/AVCHD (4 byte timecode before the sync byte)
+// or 204 bytes for DVB (16 Reed-Solomon parity bytes after the packet).
+// When a sync byte is missing the engine scans forward for the next position where
+// SYNC_CONFIRM_PACKETS sync bytes line up, counting the skipped bytes as lost.
+// Packets that straddle two blocks are stitched together in an internal buffer.
+class mptsSync
+{
+public:
+    // startOffset is the position in the input of the first block
+    mptsSync(unsigned int packetStride, int64_t startOffset = 0);
+
+    // Returns the packet stride, 188, 192 or 204, or -1 when no stride lines up
+    static int determinePacketSize(const uint8_t *buffer, size_t bufferSize);
+
+    // Offset of the sync byte inside each stride
+    unsigned int getSyncOffset() { return m_syncOffset; }
+    unsigned int getPacketStride() { return m_packetStride; }
+
+    // Hand over the next block of input, it must stay valid until nextRun() returns false.
+    // A size of 0 marks the end of the input so the last few carried packets can be flushed.
+    void setBlock(uint8_t *data, size_t size);
+
+    // Find the next run of consecutive packets in the current block.
+    // p points at the start of the first stride (timecode included), count is the number of
+    // packets, each getPacketStride() apart, and fileOffset is the position of p in the input.
+    // Returns false when the block is used up.
+    bool nextRun(uint8_t *&p, size_t &count, int64_t &fileOffset);
+
+    // Call at the end of the input, anything left unsynchronized, or a packet cut short, is counted as lost
+    void finish();
+
+    int64_t getLostBytes() { return m_lostBytes; }
+    uint64_t getResyncCount() { return m_resyncCount; }
+    const std::vector<syncLoss> &getLosses() { return m_losses; }
+
+private:
+    bool syncAt(size_t position);
+    bool confirmAt(size_t position);
+    void keepTail(size_t position);
+    void recordLoss(int64_t endOffset);
+    void locked(size_t position);
+    void switchToBlock();
+
+    unsigned int m_packetStride;
+    unsigned int m_syncOffset;
+
+    // The region being scanned, either the stitch buffer or the block
+    uint8_t *m_pData;
+    size_t m_size;
+    size_t m_position;
+    int64_t m_dataOffset;
+
+    uint8_t *m_pBlock;
+    size_t m_blockSize;
+    int64_t m_blockOffset;
+
+    // Unused bytes from the end of the last block, followed by the start of the current one
+    std::vector<uint8_t> m_stitch;
+    size_t m_carrySize;
+    int64_t m_carryOffset;
+    bool m_bStitching;
+    bool m_bEndOfInput;
+
+    bool m_bSynced;
+    int64_t m_lossStart;
+    int64_t m_lostBytes;
+    uint64_t m_resyncCount;
+    std::vector<syncLoss> m_losses;
+};
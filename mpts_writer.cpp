@@ -0,0 +1,168 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include "mpts_writer.h"
+
+asyncWriter::asyncWriter(FILE *pFile, size_t queueDepth)
+    : m_pFile(pFile)
+    , m_buffers(queueDepth < 2 ? 2 : queueDepth)
+    , m_written(0)
+    , m_queued(0)
+    , m_bProducerWaiting(false)
+    , m_bWriterWaiting(false)
+    , m_bStop(false)
+    , m_bufferCount(0)
+    , m_byteCount(0)
+    , m_stallCount(0)
+    , m_stallSeconds(0.)
+    , m_highWaterMark(0)
+{
+    m_thread = std::thread(&asyncWriter::writerThread, this);
+}
+
+asyncWriter::~asyncWriter()
+{
+    finish();
+}
+
+// Each side stores its count before it looks whether the other side sleeps, and flags itself
+// as sleeping before it looks at the other side's count, so a wake up can't be missed
+void asyncWriter::write(std::vector<char> &buffer, size_t used)
+{
+    uint64_t queued = m_queued.load(std::memory_order_relaxed);
+
+    if(queued - m_written.load() == m_buffers.size())
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            m_bProducerWaiting = true;
+            m_writtenCondition.wait(lock, [&] { return queued - m_written.load() < m_buffers.size(); });
+            m_bProducerWaiting = false;
+        }
+
+        std::chrono::duration<double> waited = std::chrono::steady_clock::now() - start;
+
+        m_stallCount++;
+        m_stallSeconds += waited.count();
+    }
+
+    queuedBuffer &slot = m_buffers[queued % m_buffers.size()];
+
+    slot.data.swap(buffer);
+    slot.used = used;
+
+    if(buffer.size() < slot.data.size())
+        buffer.resize(slot.data.size());
+
+    size_t waiting = (size_t) (queued + 1 - m_written.load());
+
+    if(waiting > m_highWaterMark)
+        m_highWaterMark = waiting;
+
+    m_queued = queued + 1;
+
+    if(m_bWriterWaiting)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queuedCondition.notify_one();
+    }
+
+    m_bufferCount++;
+    m_byteCount += used;
+}
+
+void asyncWriter::writerThread()
+{
+    for(;;)
+    {
+        uint64_t written = m_written.load(std::memory_order_relaxed);
+
+        if(written == m_queued)
+        {
+            // Nothing more to write for now, let a reader of the output see everything so far
+            fflush(m_pFile);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            m_bWriterWaiting = true;
+            m_queuedCondition.wait(lock, [&] { return written != m_queued || m_bStop; });
+            m_bWriterWaiting = false;
+
+            // Only stop once everything queued is out
+            if(written == m_queued)
+                return;
+        }
+
+        queuedBuffer &slot = m_buffers[written % m_buffers.size()];
+
+        fwrite(slot.data.data(), 1, slot.used, m_pFile);
+
+        m_written = written + 1;
+
+        if(m_bProducerWaiting)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_writtenCondition.notify_one();
+        }
+    }
+}
+
+void asyncWriter::drain()
+{
+    uint64_t queued = m_queued.load(std::memory_order_relaxed);
+
+    if(queued != m_written.load())
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_bProducerWaiting = true;
+        m_writtenCondition.wait(lock, [&] { return queued == m_written.load(); });
+        m_bProducerWaiting = false;
+    }
+
+    fflush(m_pFile);
+}
+
+void asyncWriter::finish()
+{
+    if(m_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bStop = true;
+        }
+
+        m_queuedCondition.notify_one();
+        m_thread.join();
+
+        fflush(m_pFile);
+    }
+}
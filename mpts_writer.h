@@ -0,0 +1,98 @@
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Buffers of output that can wait for the writer thread
+#define WRITER_QUEUE_DEPTH 4
+
+// Writes the output to its file on a thread of its own, so a slow pipe or disk doesn't hold up the parse.
+// util::outputSink hands over each full buffer through a single producer, single consumer ring and gets
+// an empty one back. Passing a buffer takes no lock, a side only sleeps when the ring is full or empty.
+// One thread at a time may write, see util::setXmlWriter().
+class asyncWriter
+{
+public:
+    asyncWriter(FILE *pFile, size_t queueDepth = WRITER_QUEUE_DEPTH);
+    ~asyncWriter();
+
+    FILE *getFile() const { return m_pFile; }
+
+    // Queue the first used bytes of buffer, buffer is swapped for an empty one of at least the same size.
+    // Waits while every buffer is still queued.
+    void write(std::vector<char> &buffer, size_t used);
+
+    // Wait until everything queued is in the file, the thread carries on
+    void drain();
+
+    // Write out everything queued and stop the thread
+    void finish();
+
+    // How the ring coped, only valid on the writing thread or after finish()
+    uint64_t getBufferCount() const { return m_bufferCount; }
+    uint64_t getByteCount() const { return m_byteCount; }
+    uint64_t getStallCount() const { return m_stallCount; }     // Writes that waited for a free buffer
+    double getStallSeconds() const { return m_stallSeconds; }   // Time they waited
+    size_t getHighWaterMark() const { return m_highWaterMark; } // Most buffers queued at once
+
+private:
+    void writerThread();
+
+    struct queuedBuffer
+    {
+        std::vector<char> data;
+        size_t used;
+    };
+
+    FILE *m_pFile;
+    std::vector<queuedBuffer> m_buffers;
+
+    // Both only ever go up, the buffer of a count is m_buffers[count % m_buffers.size()]
+    std::atomic<uint64_t> m_written;    // Buffers written by the writer thread
+    std::atomic<uint64_t> m_queued;     // Buffers queued by the producer
+
+    std::atomic<bool> m_bProducerWaiting;
+    std::atomic<bool> m_bWriterWaiting;
+    std::atomic<bool> m_bStop;
+    std::mutex m_mutex;
+    std::condition_variable m_queuedCondition;
+    std::condition_variable m_writtenCondition;
+    std::thread m_thread;
+
+    uint64_t m_bufferCount;
+    uint64_t m_byteCount;
+    uint64_t m_stallCount;
+    double m_stallSeconds;
+    size_t m_highWaterMark;
+};
@@ -119,6 +119,7 @@ ProcessNaluResult avcParser::processNalu(uint8_t* p,
             break;
 
         case eAVCNaluType_CodedSliceIdrPicture:
+            processSliceLayerWithoutPartitioning(p, nalData.slice_header, nalData.sequence_parameter_set);
             ret.result = eAVCNaluType_CodedSliceIdrPicture;
             bDone = true;
             break;
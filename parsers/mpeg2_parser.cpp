@@ -34,6 +34,7 @@ size_t mpeg2Parser::processVideoFrames(uint8_t *p, size_t PESPacketDataLength, u
     size_t bytesProcessed = 0;
     bool bDone = false;
     framesReceived = 0;
+    m_bGroupStart = false;
 
     while(bytesProcessed < PESPacketDataLength && !bDone)
     {
@@ -327,6 +328,7 @@ size_t mpeg2Parser::processGroupOfPicturesHeader(uint8_t *&p)
 
     util::printfXml(2, "<closed_gop>%d</closed_gop>\n", closed_gop);
 
+    m_bGroupStart = true;
     m_nextMpeg2ExtensionType = extension_and_user_data_1;
 
     return p - pStart;
@@ -346,6 +348,8 @@ size_t mpeg2Parser::processPictureHeader(uint8_t *&p)
     uint8_t picture_coding_type = (fourBytes & 0x00380000) >> 19;
     uint16_t vbv_delay =          (fourBytes & 0x0007FFF8) >> 3;
 
+    m_pictureCodingType = picture_coding_type;
+
     uint8_t carry_over = fourBytes & 0x07;
     uint8_t carry_over_bits = 3;
     uint8_t full_pel_forward_vector = 0;
@@ -141,6 +141,12 @@ public:
         unsigned int framesWanted,
         unsigned int& framesReceived) override;
 
+    // picture_coding_type of the last picture header, 1 = I, 2 = P, 3 = B
+    uint8_t getPictureCodingType() const { return m_pictureCodingType; }
+
+    // The last frame had a group of pictures header before its picture header
+    bool getGroupStart() const { return m_bGroupStart; }
+
 private:
     // Entire stream data available in memory
     size_t processVideoPES(uint8_t *p, size_t PESPacketDataLength);
@@ -158,4 +164,6 @@ private:
 
     eMpeg2ExtensionType m_nextMpeg2ExtensionType;
     unsigned int m_frameNumber = 0;
+    uint8_t m_pictureCodingType = 0;
+    bool m_bGroupStart = false;
 };
\ No newline at end of file
@@ -1,25 +1,194 @@
-/*
-    Original code by Mike Cancilla (https://github.com/mikecancilla)
-    2019
-
-    This software is provided 'as-is', without any express or implied
-    warranty. In no event will the authors be held liable for any
-    damages arising from the use of this software.
-
-    Permission is granted to anyone to use this software for any
-    purpose, including commercial applications, and to alter it and
-    redistribute it freely, subject to the following restrictions:
-
-    1. The origin of this software must not be misrepresented; you must
-    not claim that you wrote the original software. If you use this
-    software in a product, an acknowledgment in the product documentation
-    would be appreciated but is not required.
-
-    2. Altered source versions must be plainly marked as such, and
-    must not be misrepresented as being the original software.
-
-    3. This notice may not be removed or altered from any source
-    distribution.
-*/
+/*
+    Original code by Mike Cancilla (https://github.com/mikecancilla)
+    2019
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must
+    not claim that you wrote the original software. If you use this
+    software in a product, an acknowledgment in the product documentation
+    would be appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and
+    must not be misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
 
 #include "util.h"
+#include "mpts_writer.h"
+
+namespace util
+{
+    // crcTables[0] is the usual byte at a time table, crcTables[k] moves a byte k more bytes along
+    struct crcTables
+    {
+        uint32_t table[8][256];
+
+        crcTables()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t crc = i << 24;
+
+                for (int bit = 0; bit < 8; bit++)
+                    crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+
+                table[0][i] = crc;
+            }
+
+            for (int k = 1; k < 8; k++)
+                for (uint32_t i = 0; i < 256; i++)
+                    table[k][i] = (table[k - 1][i] << 8) ^ table[0][table[k - 1][i] >> 24];
+        }
+    };
+
+    static const crcTables s_crc;
+
+    uint32_t crc32(const uint8_t* p, size_t size, uint32_t crc)
+    {
+        const uint32_t (*t)[256] = s_crc.table;
+
+        for (; size >= 8; size -= 8, p += 8)
+        {
+            uint32_t high = crc ^ read4Bytes((uint8_t*) p);
+            uint32_t low = read4Bytes((uint8_t*) p + 4);
+
+            crc = t[7][high >> 24] ^ t[6][(high >> 16) & 0xFF] ^ t[5][(high >> 8) & 0xFF] ^ t[4][high & 0xFF] ^
+                  t[3][low >> 24] ^ t[2][(low >> 16) & 0xFF] ^ t[1][(low >> 8) & 0xFF] ^ t[0][low & 0xFF];
+        }
+
+        for (; size; size--, p++)
+            crc = (crc << 8) ^ t[0][(crc >> 24) ^ *p];
+
+        return crc;
+    }
+
+    bool readLine(FILE* pFile, std::string& line)
+    {
+        char buffer[4096];
+
+        line.clear();
+
+        while (fgets(buffer, sizeof(buffer), pFile))
+        {
+            line += buffer;
+
+            if ('\n' == line.back())
+                break;
+        }
+
+        return false == line.empty();
+    }
+}
+
+namespace util
+{
+    outputSink::outputSink(size_t bufferSize)
+        : m_buffer(bufferSize)
+        , m_used(0)
+        , m_pFile(stdout)
+        , m_pWriter(nullptr)
+    {
+    }
+
+    outputSink::~outputSink()
+    {
+        flush();
+    }
+
+    void outputSink::setFile(FILE* pFile)
+    {
+        flush();
+        m_pFile = pFile;
+        m_pWriter = nullptr;
+    }
+
+    void outputSink::setWriter(asyncWriter* pWriter)
+    {
+        flush();
+        m_pFile = pWriter ? pWriter->getFile() : nullptr;
+        m_pWriter = pWriter;
+    }
+
+    void outputSink::flush()
+    {
+        if (m_used && m_pWriter)
+            m_pWriter->write(m_buffer, m_used);
+        else if (m_used && m_pFile)
+            fwrite(m_buffer.data(), 1, m_used, m_pFile);
+
+        m_used = 0;
+    }
+
+    void outputSink::write(const char* p, size_t size)
+    {
+        if (nullptr == m_pFile)
+            return;
+
+        if (size > m_buffer.size() - m_used)
+        {
+            flush();
+
+            // Too big to be worth buffering, unless the writer thread has to do the writing
+            if (size > m_buffer.size() && m_pWriter)
+                m_buffer.resize(size);
+            else if (size > m_buffer.size())
+            {
+                fwrite(p, 1, size, m_pFile);
+                return;
+            }
+        }
+
+        memcpy(m_buffer.data() + m_used, p, size);
+        m_used += size;
+    }
+
+    void outputSink::print(unsigned int indentLevel, const char* format, va_list args)
+    {
+        static const char spaces[] = "                                                                ";
+
+        if (nullptr == m_pFile)
+            return;
+
+        size_t indent = indentLevel * 2;
+
+        if (indent >= sizeof(spaces))
+            indent = sizeof(spaces) - 1;
+
+        if (indent + 1 > m_buffer.size() - m_used)
+            flush();
+
+        va_list retry;
+        va_copy(retry, args);
+
+        memcpy(m_buffer.data() + m_used, spaces, indent);
+
+        size_t room = m_buffer.size() - m_used - indent;
+        int length = vsnprintf(m_buffer.data() + m_used + indent, room, format, args);
+
+        if (length >= 0 && (size_t) length >= room)
+        {
+            // It did not fit, write out the lines before it and format it again at the start
+            flush();
+
+            if (indent + length + 1 > m_buffer.size())
+                m_buffer.resize(indent + length + 1);
+
+            memcpy(m_buffer.data(), spaces, indent);
+            vsnprintf(m_buffer.data() + indent, m_buffer.size() - indent, format, retry);
+        }
+
+        if (length >= 0)
+            m_used += indent + length;
+
+        va_end(retry);
+    }
+}
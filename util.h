@@ -25,12 +25,27 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <cstdio>
 #include <cstdint>
 #include <cstddef>
 #include <cstring>
 #include <cstdarg>
 #include <cassert>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Bytes of xml gathered before each write
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+class asyncWriter;
+
 namespace util
 {
     inline uint16_t read2Bytes(uint8_t* p)
@@ -143,33 +158,135 @@ namespace util
         return 4;
     }
 
-    static bool g_bXmlOut = false;
+    // Search for the 0x47 transport stream sync byte, 16 bytes at a time where SSE2 is available.
+    // Returns size when there is none.
+    inline size_t findSyncByte(const uint8_t* p, size_t size)
+    {
+        size_t i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+        const __m128i sync = _mm_set1_epi8(0x47);
+
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i*) (p + i));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, sync));
+
+            if (mask)
+            {
+#ifdef _MSC_VER
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+                return i + bit;
+#else
+                return i + __builtin_ctz(mask);
+#endif
+            }
+        }
+#endif
+
+        for (; i < size; i++)
+        {
+            if (0x47 == p[i])
+                return i;
+        }
+
+        return size;
+    }
+
+    // CRC-32/MPEG-2 of Annex A, polynomial 0x04C11DB7 without reflection or final xor.
+    // Worked 8 bytes at a time with slice-by-8 tables. A PSI section, CRC_32 included, gives 0 when intact.
+    uint32_t crc32(const uint8_t* p, size_t size, uint32_t crc = 0xFFFFFFFF);
+
+    // The next line of a text file however long, with its '\n' unless it is the last. False at the end.
+    bool readLine(FILE* pFile, std::string& line);
+
+    // Collects output in one large buffer and hands it to its FILE with a single fwrite once full,
+    // or to an asyncWriter that writes it on another thread.
+    // Lines of any length fit, the buffer grows for a line longer than itself.
+    class outputSink
+    {
+    public:
+        outputSink(size_t bufferSize = OUTPUT_BUFFER_SIZE);
+        ~outputSink();
+
+        // Write out what is buffered for the old file first, nullptr throws output away
+        void setFile(FILE* pFile);
+        FILE* getFile() const { return m_pFile; }
+
+        // Output goes to the writer's file through the writer
+        void setWriter(asyncWriter* pWriter);
+        asyncWriter* getWriter() const { return m_pWriter; }
+
+        void write(const char* p, size_t size);
+        void print(unsigned int indentLevel, const char* format, va_list args);
+        void flush();
+
+    private:
+        std::vector<char> m_buffer;
+        size_t m_used;
+        FILE* m_pFile;
+        asyncWriter* m_pWriter;
+    };
+
+    inline bool g_bXmlOut = false;
+
+    // Each thread can send its xml somewhere else
+    inline thread_local outputSink g_xmlSink;
 
     void inline setXmlOutput(bool tf)
     {
         g_bXmlOut = tf;
     }
 
-    void inline printfXml(unsigned int indentLevel, const char* format, ...)
+    void inline setXmlFile(FILE* pFile)
     {
-        if (g_bXmlOut && format)
-        {
-            char outputBuffer[512] = "";
+        g_xmlSink.setFile(pFile);
+    }
+
+    inline FILE* getXmlFile()
+    {
+        return g_xmlSink.getFile();
+    }
 
-            // See here: https://en.cppreference.com/w/cpp/io/c/vfprintf
-            
-            for (unsigned int i = 0; i < indentLevel; i++)
-                strncpy(outputBuffer + (i * 2), "  ", 2);
+    // Only one thread at a time may send its output through the same writer
+    void inline setXmlWriter(asyncWriter* pWriter)
+    {
+        g_xmlSink.setWriter(pWriter);
+    }
+
+    inline asyncWriter* getXmlWriter()
+    {
+        return g_xmlSink.getWriter();
+    }
 
+    // Everything printed so far reaches the file
+    void inline flushXml()
+    {
+        g_xmlSink.flush();
+    }
+
+    // Text that is already formatted, like xml copied from elsewhere
+    void inline writeXml(const char* p, size_t size)
+    {
+        if (g_bXmlOut)
+            g_xmlSink.write(p, size);
+    }
+
+    // Output in another format, written even while xml is turned off
+    void inline writeOutput(const void* p, size_t size)
+    {
+        g_xmlSink.write((const char*) p, size);
+    }
+
+    void inline printfXml(unsigned int indentLevel, const char* format, ...)
+    {
+        if (g_bXmlOut && g_xmlSink.getFile() && format)
+        {
             va_list arg_list;
             va_start(arg_list, format);
-            vsnprintf(outputBuffer + (indentLevel * 2),
-                512,
-                format,
-                arg_list);
+            g_xmlSink.print(indentLevel, format, arg_list);
             va_end(arg_list);
-
-            printf("%s", outputBuffer);
         }
     }
 